@@ -111,6 +111,18 @@ void selectIntKeysToInsert(const unsigned percent,
     sort(insert_keys.begin(), insert_keys.end());
 }
 
+// sorted and de-duplicated, without keys that are a prefix of their
+// successor, which the FST builder does not support
+std::vector<std::string> sortedUnique(std::vector<std::string> keys) {
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::vector<std::string> result;
+    for (size_t i = 0; i < keys.size(); i++)
+	if (i + 1 == keys.size() || keys[i + 1].compare(0, keys[i].size(), keys[i]) != 0)
+	    result.push_back(keys[i]);
+    return result;
+}
+
 // pos > 0, position counting from the last byte
 void modifyKeyByte(std::vector<std::string> &keys, int pos) {
     for (int i = 0; i < (int)keys.size(); i++) {
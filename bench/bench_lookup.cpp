@@ -0,0 +1,110 @@
+#include "bench.hpp"
+
+#include "fixed_key_fst.hpp"
+#include "fst.hpp"
+
+// Single-key lookup latency with stored and with implicit values (key
+// ordinals), and with the stored-value trie moved into one arena by
+// compact(). The random integer keys are also looked up as integers, with
+// FST::lookupKey(uint64_t) and with FixedKeyFST<uint64_t>. Built three times
+// by CMake: as bench_lookup, as bench_lookup_prefetch (with FST_PREFETCH) to
+// compare the cross-level prefetches of the lookup path, and as
+// bench_lookup_wide (with FST_WIDE_POSITIONS) to measure the cost of 64-bit
+// positions.
+
+static const uint64_t kNumKeys = 20000000;
+static const uint64_t kNumQueries = 5000000;
+static const int kNumRuns = 3;
+
+template <typename Query, typename Lookup>
+void benchLookups(const std::string &name, const std::vector<Query> &queries, const uint64_t memory,
+                  Lookup lookup) {
+  double best = 0;
+  uint64_t checksum = 0;
+  for (int run = 0; run < kNumRuns; run++) {
+    double start = bench::getNow();
+    for (const auto &query : queries) {
+      uint64_t value = 0;
+      lookup(query, value);
+      checksum += value;
+    }
+    double time = bench::getNow() - start;
+    if (run == 0 || time < best) best = time;
+  }
+  std::cout << name << ": " << memory << " bytes, " << (best / queries.size() * 1e9) << " ns/lookup (checksum "
+            << checksum << ")\n";
+}
+
+void benchKeys(const std::string &name, const std::vector<std::string> &keys) {
+  std::vector<uint64_t> values(keys.size());
+  for (uint64_t i = 0; i < keys.size(); i++) values[i] = i;
+  fst::FST fst(keys, values);
+
+  std::mt19937_64 rng(42);
+  std::vector<std::string> queries(kNumQueries);
+  for (auto &query : queries) query = keys[rng() % keys.size()];
+
+  std::cout << name << ": " << keys.size() << " keys\n";
+  auto lookup = [](const fst::FST &trie) {
+    return [&trie](const std::string &query, uint64_t &value) { trie.lookupKey(query, value); };
+  };
+  benchLookups("  stored values", queries, fst.getMemoryUsage(), lookup(fst));
+
+  fst::FST compact_fst(keys, values);
+  compact_fst.compact();
+  benchLookups("  stored values, compacted", queries, compact_fst.getMemoryUsage(), lookup(compact_fst));
+
+  // the values are the key ordinals, so the checksums match
+  fst::FST implicit_fst(keys);
+  benchLookups("  implicit values", queries, implicit_fst.getMemoryUsage(), lookup(implicit_fst));
+}
+
+void benchIntegerKeys(const std::string &name, const std::vector<uint64_t> &keys) {
+  std::vector<uint64_t> values(keys.size());
+  for (uint64_t i = 0; i < keys.size(); i++) values[i] = i;
+
+  std::mt19937_64 rng(42);
+  std::vector<uint64_t> queries(kNumQueries);
+  for (auto &query : queries) query = keys[rng() % keys.size()];
+
+  std::cout << name << " as integers: " << keys.size() << " keys\n";
+  fst::FST fst(keys, values);
+  benchLookups("  FST::lookupKey(uint64_t)", queries, fst.getMemoryUsage(),
+               [&fst](const uint64_t query, uint64_t &value) { fst.lookupKey(query, value); });
+
+  // the same trie, so the memory and the checksums match
+  fst::FixedKeyFST<uint64_t> fixed_fst(keys, values);
+  benchLookups("  FixedKeyFST<uint64_t>", queries, fixed_fst.getFST().getMemoryUsage(),
+               [&fixed_fst](const uint64_t query, uint64_t &value) { fixed_fst.lookupKey(query, value); });
+}
+
+int main(int argc, char *argv[]) {
+#ifdef FST_PREFETCH
+  std::cout << "FST_PREFETCH on\n";
+#else
+  std::cout << "FST_PREFETCH off\n";
+#endif
+#ifdef FST_WIDE_POSITIONS
+  std::cout << "FST_WIDE_POSITIONS on\n";
+#else
+  std::cout << "FST_WIDE_POSITIONS off\n";
+#endif
+  std::mt19937_64 rng(1);
+
+  std::vector<std::string> keys;
+  for (uint64_t i = 0; i < kNumKeys; i++) keys.push_back(bench::uint64ToString(rng()));
+  keys = bench::sortedUnique(keys);
+  benchKeys("randint", keys);
+  std::vector<uint64_t> int_keys;
+  for (const auto &key : keys) int_keys.push_back(bench::stringToUint64(key));
+  std::vector<std::string>().swap(keys);
+  benchIntegerKeys("randint", int_keys);
+
+  // string keys, one per line, e.g. emails
+  for (int i = 1; i < argc; i++) {
+    std::vector<std::string> file_keys;
+    bench::loadKeysFromFile(argv[i], false, file_keys);
+    benchKeys(argv[i], bench::sortedUnique(file_keys));
+  }
+  return 0;
+}
@@ -0,0 +1,71 @@
+#include "bench.hpp"
+
+#include "fst_builder.hpp"
+#include "select.hpp"
+#include "select_inventory.hpp"
+
+// Compares the sampling select (BitvectorSelect) with the two-level
+// inventory select (BitvectorSelectInventory) on the LOUDS-Sparse bits of
+// tries built from different key distributions.
+
+static const uint64_t kNumKeys = 10000000;
+static const uint64_t kNumQueries = 10000000;
+static const fst::position_t kSelectSampleInterval = 64;
+
+template <typename Select>
+double runSelect(const Select &bv, const std::vector<fst::position_t> &ranks, uint64_t &checksum) {
+  double start = bench::getNow();
+  for (fst::position_t rank : ranks) checksum += bv.select(rank);
+  return bench::getNow() - start;
+}
+
+void benchKeys(const std::string &name, const std::vector<std::string> &keys) {
+  std::vector<uint64_t> values(keys.size());
+  fst::FSTBuilder builder(true, 16);
+  builder.build(keys, values);
+
+  std::vector<fst::position_t> num_items_per_level;
+  for (const auto &labels : builder.getLabels()) num_items_per_level.push_back(labels.size());
+  fst::level_t start_level = builder.getSparseStartLevel();
+  fst::level_t height = builder.getTreeHeight();
+
+  fst::BitvectorSelect sampled(kSelectSampleInterval, builder.getLoudsBits(), num_items_per_level,
+                               start_level, height);
+  fst::BitvectorSelectInventory inventory(builder.getLoudsBits(), num_items_per_level, start_level, height);
+
+  std::mt19937_64 rng(42);
+  std::vector<fst::position_t> ranks(kNumQueries);
+  for (auto &rank : ranks) rank = rng() % sampled.numOnes() + 1;
+
+  uint64_t checksum_sampled = 0, checksum_inventory = 0;
+  double time_sampled = runSelect(sampled, ranks, checksum_sampled);
+  double time_inventory = runSelect(inventory, ranks, checksum_inventory);
+  if (checksum_sampled != checksum_inventory) std::cout << bench::kRed << "MISMATCH " << bench::kNoColor;
+
+  std::cout << name << ": bits " << sampled.numBits() << ", ones " << sampled.numOnes() << "\n";
+  std::cout << "  sampling  " << (time_sampled / kNumQueries * 1e9) << " ns/select, "
+            << sampled.size() << " bytes\n";
+  std::cout << "  inventory " << (time_inventory / kNumQueries * 1e9) << " ns/select, "
+            << inventory.size() << " bytes\n";
+}
+
+int main(int argc, char *argv[]) {
+  std::mt19937_64 rng(1);
+
+  std::vector<std::string> keys;
+  for (uint64_t i = 0; i < kNumKeys; i++) keys.push_back(bench::uint64ToString(rng()));
+  benchKeys("randint", bench::sortedUnique(keys));
+
+  keys.clear();
+  uint64_t key = 0;
+  for (uint64_t i = 0; i < kNumKeys; i++) keys.push_back(bench::uint64ToString(key += rng() % 64 + 1));
+  benchKeys("monoint", bench::sortedUnique(keys));
+
+  // string keys, one per line, e.g. emails or words
+  for (int i = 1; i < argc; i++) {
+    std::vector<std::string> file_keys;
+    bench::loadKeysFromFile(argv[i], false, file_keys);
+    benchKeys(argv[i], bench::sortedUnique(file_keys));
+  }
+  return 0;
+}
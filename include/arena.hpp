@@ -0,0 +1,92 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <sys/mman.h>
+
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+
+#include "config.hpp"
+
+namespace fst {
+
+// One contiguous, cache-line aligned allocation holding every array of a
+// compacted FST (see FST::compact). Backed either by anonymous mappings
+// rounded to 2 MiB huge pages or by a caller-supplied memory resource.
+class Arena {
+ public:
+  static const uint64_t kHugePageSize = uint64_t(1) << 21;
+
+  enum class Backing {
+    // transparent huge pages, requested with madvise(MADV_HUGEPAGE)
+    kHugePages,
+    // explicit MAP_HUGETLB pages; falls back to kHugePages if the huge page
+    // pool cannot serve the mapping
+    kHugeTlb,
+  };
+
+  Arena(uint64_t size, Backing backing);
+
+  Arena(uint64_t size, std::pmr::memory_resource *resource);
+
+  ~Arena();
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  char *data() const { return data_; }
+
+  // usable bytes, as requested
+  uint64_t size() const { return size_; }
+
+  // bytes reserved, including the rounding to huge pages
+  uint64_t capacity() const { return capacity_; }
+
+ private:
+  char *data_;
+  uint64_t size_;
+  uint64_t capacity_;
+  std::pmr::memory_resource *resource_{nullptr};
+};
+
+const uint64_t Arena::kHugePageSize;
+
+Arena::Arena(const uint64_t size, const Backing backing)
+    : size_(size), capacity_((size + kHugePageSize - 1) / kHugePageSize * kHugePageSize) {
+  if (capacity_ == 0) capacity_ = kHugePageSize;
+  void *mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (backing == Backing::kHugeTlb) {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_2MB
+    flags |= MAP_HUGE_2MB;
+#endif
+    mem = mmap(nullptr, capacity_, PROT_READ | PROT_WRITE, flags, -1, 0);
+  }
+#endif
+  if (mem == MAP_FAILED) {
+    mem = mmap(nullptr, capacity_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+    madvise(mem, capacity_, MADV_HUGEPAGE);
+#endif
+  }
+  data_ = static_cast<char *>(mem);
+}
+
+Arena::Arena(const uint64_t size, std::pmr::memory_resource *resource)
+    : size_(size), capacity_(size == 0 ? kCacheLineSize : size), resource_(resource) {
+  data_ = static_cast<char *>(resource_->allocate(capacity_, kCacheLineSize));
+}
+
+Arena::~Arena() {
+  if (resource_)
+    resource_->deallocate(data_, capacity_, kCacheLineSize);
+  else
+    munmap(data_, capacity_);
+}
+
+}  // namespace fst
+
+#endif  // ARENA_H_
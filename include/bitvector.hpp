@@ -61,6 +61,8 @@ class Bitvector {
  protected:
   position_t num_bits_;
   word_t *bits_;
+  // false after deSerialize: the arrays point into the serialized data
+  bool owns_memory_{true};
 };
 
 bool Bitvector::readBit(const position_t pos) const {
@@ -100,7 +102,7 @@ size_t Bitvector::getNumSetBitsInDenseNode(position_t nodeNumber, unsigned &labe
   for (auto i = 0; i < 4; i++) {
     setBits += __builtin_popcountll(bits_[nodeNumber * (kFanout / kWordSize) + i]);
     if (bits_[nodeNumber * (kFanout / kWordSize) + i] > 0) {
-     label = __builtin_clz(bits_[nodeNumber * (kFanout / kWordSize) + i] > 0) + kWordSize * i;
+     label = __builtin_clzll(bits_[nodeNumber * (kFanout / kWordSize) + i]) + kWordSize * i;
     }
   }
   return setBits;
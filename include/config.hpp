@@ -3,6 +3,10 @@
 
 #include <cstdint>
 #include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 namespace fst {
 
@@ -18,8 +22,41 @@ struct KeyPartValue {
   }
 };
 
+// Integer lookup key. Key bytes are extracted in big-endian order from the
+// word itself, so integer lookups never materialize a 4/8-byte string.
+// Provides the length()/operator[] subset of std::string_view used by the
+// lookup functions of LoudsDense and LoudsSparse.
+template <typename Int>
+struct IntegerKey {
+  Int word;
+
+  static constexpr size_t length() { return sizeof(Int); }
+
+  uint8_t operator[](const size_t level) const {
+    return static_cast<uint8_t>(word >> (8 * (sizeof(Int) - 1 - level)));
+  }
+};
+
+// Maps a stored value to the bytes of the key it was inserted with. The
+// range seeks of LoudsDense and LoudsSparse compare the searched key against
+// it when a trie branch terminates, so the keys can stay in the caller's
+// storage. An empty fetcher disables these comparisons.
+using KeyFetcher = std::function<std::string_view(uint64_t value)>;
+
+// Fetcher for FSTs whose values are indices into keys; keys must outlive it.
+inline KeyFetcher keyVectorFetcher(const std::vector<std::string> *keys) {
+  return [keys](const uint64_t value) { return std::string_view((*keys)[value]); };
+}
+
 using level_t = uint32_t;
+// Bit and label positions. FST_WIDE_POSITIONS lifts the 2^32 bits per
+// bitvector limit of the compact default, at the cost of wider rank and
+// select directories and node indexes.
+#ifdef FST_WIDE_POSITIONS
+using position_t = uint64_t;
+#else
 using position_t = uint32_t;
+#endif
 
 using label_t = uint8_t;
 static const position_t kFanout = 256;
@@ -36,9 +73,61 @@ static const label_t kTerminator = 255;
 
 static const int kHashShift = 7;
 
+// number of lookups kept in flight by FST::lookupKeys
+static const uint32_t kLookupBatchWindow = 16;
+
+// LOUDS-Sparse node index: explicit first-label positions for the nodes of
+// the top kNodeIndexLevels sparse levels (0 disables it). kNodeIndexAuto
+// indexes as many levels as fit into kNodeIndexBudgetPercent of the size of
+// the sparse encoding.
+static const level_t kNodeIndexLevels = 0;
+static const level_t kNodeIndexAuto = UINT32_MAX;
+static const uint32_t kNodeIndexBudgetPercent = 5;
+
+// cutoff levels whose expected lookup cost is within this fraction of the
+// cheapest one count as equally fast, see CutoffWorkload
+static const double kCutoffCostTolerance = 0.01;
+
+// bits per key of the negative-lookup prefilter (see prefilter.hpp) built by
+// FST::create; 0 builds no prefilter
+static const uint32_t kPrefilterBitsPerKey = 0;
+
 void align(char *&ptr) { ptr = (char *)(((uint64_t)ptr + 7) & ~((uint64_t)7)); }
 
+// Arrays of cache-line records (rank lines, dense nodes, Bloom blocks) stay
+// cache-line aligned in serialized data if the buffer is: a pad count is
+// stored and the array starts at the next 64-byte boundary. The pad always
+// takes kCacheLinePadSize bytes in total, before and after the array, so
+// sizes do not depend on the address and a copy of the data at another
+// 8-byte aligned address still deserializes.
+static const uint64_t kCacheLineSize = 64;
+static const uint64_t kCacheLinePadSize = kCacheLineSize;
+
+// Writes the pad in front of an array; returns it for padCacheLineEnd.
+uint64_t padCacheLineStart(char *&dst) {
+  uint64_t pad = (kCacheLineSize - ((uint64_t)dst + sizeof(pad)) % kCacheLineSize) % kCacheLineSize;
+  memcpy(dst, &pad, sizeof(pad));
+  memset(dst + sizeof(pad), 0, pad);
+  dst += sizeof(pad) + pad;
+  return pad;
+}
+
+uint64_t skipCacheLineStart(char *&src) {
+  uint64_t pad;
+  memcpy(&pad, src, sizeof(pad));
+  src += sizeof(pad) + pad;
+  return pad;
+}
+
+void padCacheLineEnd(char *&ptr, const uint64_t pad, const bool zero = false) {
+  uint64_t rest = kCacheLinePadSize - sizeof(pad) - pad;
+  if (zero) memset(ptr, 0, rest);
+  ptr += rest;
+}
+
+#ifndef FST_WIDE_POSITIONS
 void sizeAlign(position_t &size) { size = (size + 7) & ~((position_t)7); }
+#endif
 
 void sizeAlign(uint64_t &size) { size = (size + 7) & ~((uint64_t)7); }
 
@@ -52,6 +141,28 @@ std::string uint32ToString(const uint32_t word) {
   return std::string(reinterpret_cast<const char *>(&endian_swapped_word), 4);
 }
 
+// the big-endian byte order integer keys are stored in
+template <typename Int>
+Int toBigEndian(const Int word) {
+  static_assert(sizeof(Int) == 4 || sizeof(Int) == 8, "32 or 64-bit integer keys");
+  if constexpr (sizeof(Int) == 8)
+    return __builtin_bswap64(word);
+  else
+    return __builtin_bswap32(word);
+}
+
+// Fetcher for FSTs over integer keys whose values are indices into keys;
+// keys must outlive it. The returned bytes stay valid until the next call
+// on the same thread.
+template <typename Int>
+KeyFetcher integerKeyFetcher(const std::vector<Int> *keys) {
+  return [keys](const uint64_t value) {
+    thread_local Int word;
+    word = toBigEndian((*keys)[value]);
+    return std::string_view(reinterpret_cast<const char *>(&word), sizeof(Int));
+  };
+}
+
 uint64_t stringToUint64(const std::string &str_word) {
   uint64_t int_word = 0;
   memcpy(reinterpret_cast<char *>(&int_word), str_word.data(), 8);
@@ -0,0 +1,324 @@
+#ifndef CPUDISPATCH_H_
+#define CPUDISPATCH_H_
+
+#include <immintrin.h>
+
+#include <atomic>
+#include <cstdint>
+
+#include "config.hpp"
+#include "popcount.h"
+
+namespace fst {
+
+// Runtime selection of the bit-manipulation and label search kernels.
+// The library is compiled for the common x86-64 baseline (SSE2 + POPCNT);
+// faster kernels for BMI2, AVX2 and AVX-512 are compiled with target
+// attributes and bound on first use according to the features of the CPU
+// we run on. If the translation unit is compiled with the corresponding
+// -m flags anyway, the kernels are called directly without a dispatch.
+//
+// Single-word popcount stays the inlined POPCNT instruction: an indirect
+// call per word would cost more than any alternative saves.
+class CpuDispatch {
+ public:
+  struct Features {
+    bool bmi2;
+    bool avx2;
+    bool avx512bw;
+    bool avx512vpopcntdq;
+  };
+
+  using Select64Fn = int (*)(uint64_t x, int k);
+  using PopcountLinearFn = uint64_t (*)(const uint64_t *bits, uint64_t x, uint64_t nbits);
+  using LabelSearchFn = bool (*)(const label_t *labels, label_t target, position_t &pos, position_t search_len);
+
+  // Features of the CPU we are running on.
+  static const Features &detected() {
+    static const Features features = detect();
+    return features;
+  }
+
+  // Binds the kernels for the given features. Called on first use with
+  // detected(); tests call it to exercise the fallbacks.
+  static void bind(const Features &features);
+
+  // Same result as select64_popcount_search.
+  static int select64(const uint64_t x, const int k) {
+#ifdef __BMI2__
+    return select64_pdep(x, k);
+#else
+    return select64_.load(std::memory_order_relaxed)(x, k);
+#endif
+  }
+
+  // Same result as popcountLinear; used for rank basic blocks.
+  static uint64_t popcountLinear(const uint64_t *bits, const uint64_t x, const uint64_t nbits) {
+#ifdef __AVX512VPOPCNTDQ__
+    return popcountLinearAvx512(bits, x, nbits);
+#else
+    return popcount_linear_.load(std::memory_order_relaxed)(bits, x, nbits);
+#endif
+  }
+
+  // Label search kernels. They look at labels[pos, pos + search_len) but
+  // load whole vectors, so labels must stay readable for kLabelPadding bytes
+  // past the end of the node (see LabelVector).
+  static const position_t kLabelPadding = 64;
+
+  // Finds target and moves pos to it.
+  static bool labelSearch(const label_t *labels, const label_t target, position_t &pos,
+                          const position_t search_len) {
+#ifdef __AVX512BW__
+    return labelSearchAvx512(labels, target, pos, search_len);
+#else
+    return label_search_.load(std::memory_order_relaxed)(labels, target, pos, search_len);
+#endif
+  }
+
+  // Finds the first label greater than target and moves pos to it. Labels
+  // of a node are sorted, so this is the position to continue a seek from.
+  static bool labelSearchGreaterThan(const label_t *labels, const label_t target, position_t &pos,
+                                     const position_t search_len) {
+#ifdef __AVX512BW__
+    return labelSearchGreaterThanAvx512(labels, target, pos, search_len);
+#else
+    return label_search_greater_than_.load(std::memory_order_relaxed)(labels, target, pos, search_len);
+#endif
+  }
+
+  // Nodes of up to 16 labels take a single SSE2 compare on every CPU.
+  static bool labelSearch16(const label_t *labels, const label_t target, position_t &pos,
+                            const position_t search_len) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(labels + pos));
+    unsigned check_bits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(target), chunk));
+    check_bits &= (1U << search_len) - 1;
+    if (check_bits == 0) return false;
+    pos += __builtin_ctz(check_bits);
+    return true;
+  }
+
+  static bool labelSearchGreaterThan16(const label_t *labels, const label_t target, position_t &pos,
+                                       const position_t search_len) {
+    if (target == kMaxLabel) return false;
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(labels + pos));
+    // unsigned label > target  <=>  max(label, target + 1) == label
+    __m128i greater = _mm_cmpeq_epi8(_mm_max_epu8(chunk, _mm_set1_epi8(target + 1)), chunk);
+    unsigned check_bits = _mm_movemask_epi8(greater) & ((1U << search_len) - 1);
+    if (check_bits == 0) return false;
+    pos += __builtin_ctz(check_bits);
+    return true;
+  }
+
+  static int select64Scalar(uint64_t x, int k) { return select64_popcount_search(x, k); }
+  static int select64Bmi2(uint64_t x, int k) __attribute__((target("bmi2")));
+
+  static uint64_t popcountLinearScalar(const uint64_t *bits, uint64_t x, uint64_t nbits);
+  static uint64_t popcountLinearAvx512(const uint64_t *bits, uint64_t x, uint64_t nbits)
+      __attribute__((target("avx512f,avx512vpopcntdq")));
+
+  static bool labelSearchSse2(const label_t *labels, label_t target, position_t &pos, position_t search_len);
+  static bool labelSearchAvx2(const label_t *labels, label_t target, position_t &pos, position_t search_len)
+      __attribute__((target("avx2")));
+  static bool labelSearchAvx512(const label_t *labels, label_t target, position_t &pos, position_t search_len)
+      __attribute__((target("avx512f,avx512bw")));
+
+  static bool labelSearchGreaterThanSse2(const label_t *labels, label_t target, position_t &pos,
+                                         position_t search_len);
+  static bool labelSearchGreaterThanAvx2(const label_t *labels, label_t target, position_t &pos,
+                                         position_t search_len) __attribute__((target("avx2")));
+  static bool labelSearchGreaterThanAvx512(const label_t *labels, label_t target, position_t &pos,
+                                           position_t search_len) __attribute__((target("avx512f,avx512bw")));
+
+ private:
+  static Features detect();
+
+  // Initial targets of the kernel pointers: bind the detected kernels, then
+  // forward. Binding only ever stores the same values, so concurrent first
+  // calls are harmless.
+  static int resolveSelect64(uint64_t x, int k) {
+    bind(detected());
+    return select64_.load(std::memory_order_relaxed)(x, k);
+  }
+
+  static uint64_t resolvePopcountLinear(const uint64_t *bits, uint64_t x, uint64_t nbits) {
+    bind(detected());
+    return popcount_linear_.load(std::memory_order_relaxed)(bits, x, nbits);
+  }
+
+  static bool resolveLabelSearch(const label_t *labels, label_t target, position_t &pos, position_t search_len) {
+    bind(detected());
+    return label_search_.load(std::memory_order_relaxed)(labels, target, pos, search_len);
+  }
+
+  static bool resolveLabelSearchGreaterThan(const label_t *labels, label_t target, position_t &pos,
+                                            position_t search_len) {
+    bind(detected());
+    return label_search_greater_than_.load(std::memory_order_relaxed)(labels, target, pos, search_len);
+  }
+
+  static const label_t kMaxLabel = 255;
+
+  static inline std::atomic<Select64Fn> select64_{resolveSelect64};
+  static inline std::atomic<PopcountLinearFn> popcount_linear_{resolvePopcountLinear};
+  static inline std::atomic<LabelSearchFn> label_search_{resolveLabelSearch};
+  static inline std::atomic<LabelSearchFn> label_search_greater_than_{resolveLabelSearchGreaterThan};
+};
+
+const position_t CpuDispatch::kLabelPadding;
+const label_t CpuDispatch::kMaxLabel;
+
+CpuDispatch::Features CpuDispatch::detect() {
+  __builtin_cpu_init();
+  Features features{};
+  features.bmi2 = __builtin_cpu_supports("bmi2");
+  features.avx2 = __builtin_cpu_supports("avx2");
+  features.avx512bw = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+  features.avx512vpopcntdq = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq");
+  return features;
+}
+
+void CpuDispatch::bind(const Features &features) {
+  select64_.store(features.bmi2 ? select64Bmi2 : select64Scalar, std::memory_order_relaxed);
+  popcount_linear_.store(features.avx512vpopcntdq ? popcountLinearAvx512 : popcountLinearScalar,
+                         std::memory_order_relaxed);
+  if (features.avx512bw) {
+    label_search_.store(labelSearchAvx512, std::memory_order_relaxed);
+    label_search_greater_than_.store(labelSearchGreaterThanAvx512, std::memory_order_relaxed);
+  } else if (features.avx2) {
+    label_search_.store(labelSearchAvx2, std::memory_order_relaxed);
+    label_search_greater_than_.store(labelSearchGreaterThanAvx2, std::memory_order_relaxed);
+  } else {
+    label_search_.store(labelSearchSse2, std::memory_order_relaxed);
+    label_search_greater_than_.store(labelSearchGreaterThanSse2, std::memory_order_relaxed);
+  }
+}
+
+int CpuDispatch::select64Bmi2(const uint64_t x, const int k) {
+  return __builtin_clzll(_pdep_u64(1ULL << (popcount(x) - k), x));
+}
+
+uint64_t CpuDispatch::popcountLinearScalar(const uint64_t *bits, const uint64_t x, const uint64_t nbits) {
+  return fst::popcountLinear(const_cast<uint64_t *>(bits), x, nbits);
+}
+
+uint64_t CpuDispatch::popcountLinearAvx512(const uint64_t *bits, uint64_t x, const uint64_t nbits) {
+  if (nbits == 0) return 0;
+  // whole words before the last one, eight at a time, then the shifted last word
+  uint64_t lastword = (nbits - 1) / kWordSize;
+  __m512i counts = _mm512_setzero_si512();
+  uint64_t i = 0;
+  for (; i + 8 <= lastword; i += 8)
+    counts = _mm512_add_epi64(counts, _mm512_popcnt_epi64(_mm512_loadu_si512(bits + x + i)));
+  __mmask8 mask = static_cast<__mmask8>((1U << (lastword - i)) - 1);
+  counts = _mm512_add_epi64(counts, _mm512_popcnt_epi64(_mm512_maskz_loadu_epi64(mask, bits + x + i)));
+  // summed by hand: _mm512_reduce_add_epi64 trips -Wmaybe-uninitialized in GCC 12
+  alignas(64) uint64_t lanes[8];
+  _mm512_store_si512(lanes, counts);
+  uint64_t p = popcount(bits[x + lastword] >> (63 - ((nbits - 1) & (kWordSize - 1))));
+  for (uint64_t lane : lanes) p += lane;
+  return p;
+}
+
+// The kernels below step through the node one vector at a time and mask
+// the compare result of the last vector to the labels of the node.
+
+bool CpuDispatch::labelSearchSse2(const label_t *labels, const label_t target, position_t &pos,
+                                  const position_t search_len) {
+  const __m128i target_vec = _mm_set1_epi8(target);
+  for (position_t searched = 0; searched < search_len; searched += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(labels + pos + searched));
+    unsigned check_bits = _mm_movemask_epi8(_mm_cmpeq_epi8(target_vec, chunk));
+    if (search_len - searched < 16) check_bits &= (1U << (search_len - searched)) - 1;
+    if (check_bits) {
+      pos += searched + __builtin_ctz(check_bits);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CpuDispatch::labelSearchAvx2(const label_t *labels, const label_t target, position_t &pos,
+                                  const position_t search_len) {
+  if (search_len <= 16) return labelSearch16(labels, target, pos, search_len);
+  const __m256i target_vec = _mm256_set1_epi8(target);
+  for (position_t searched = 0; searched < search_len; searched += 32) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(labels + pos + searched));
+    unsigned check_bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(target_vec, chunk));
+    if (search_len - searched < 32) check_bits &= (1U << (search_len - searched)) - 1;
+    if (check_bits) {
+      pos += searched + __builtin_ctz(check_bits);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CpuDispatch::labelSearchAvx512(const label_t *labels, const label_t target, position_t &pos,
+                                    const position_t search_len) {
+  if (search_len <= 16) return labelSearch16(labels, target, pos, search_len);
+  const __m512i target_vec = _mm512_set1_epi8(target);
+  for (position_t searched = 0; searched < search_len; searched += 64) {
+    __m512i chunk = _mm512_loadu_si512(labels + pos + searched);
+    uint64_t check_bits = _mm512_cmpeq_epi8_mask(chunk, target_vec);
+    if (search_len - searched < 64) check_bits &= (1ULL << (search_len - searched)) - 1;
+    if (check_bits) {
+      pos += searched + __builtin_ctzll(check_bits);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CpuDispatch::labelSearchGreaterThanSse2(const label_t *labels, const label_t target, position_t &pos,
+                                             const position_t search_len) {
+  if (target == kMaxLabel) return false;
+  const __m128i bound = _mm_set1_epi8(target + 1);
+  for (position_t searched = 0; searched < search_len; searched += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(labels + pos + searched));
+    unsigned check_bits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(chunk, bound), chunk));
+    if (search_len - searched < 16) check_bits &= (1U << (search_len - searched)) - 1;
+    if (check_bits) {
+      pos += searched + __builtin_ctz(check_bits);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CpuDispatch::labelSearchGreaterThanAvx2(const label_t *labels, const label_t target, position_t &pos,
+                                             const position_t search_len) {
+  if (search_len <= 16) return labelSearchGreaterThan16(labels, target, pos, search_len);
+  if (target == kMaxLabel) return false;
+  const __m256i bound = _mm256_set1_epi8(target + 1);
+  for (position_t searched = 0; searched < search_len; searched += 32) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(labels + pos + searched));
+    unsigned check_bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(chunk, bound), chunk));
+    if (search_len - searched < 32) check_bits &= (1U << (search_len - searched)) - 1;
+    if (check_bits) {
+      pos += searched + __builtin_ctz(check_bits);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CpuDispatch::labelSearchGreaterThanAvx512(const label_t *labels, const label_t target, position_t &pos,
+                                               const position_t search_len) {
+  if (search_len <= 16) return labelSearchGreaterThan16(labels, target, pos, search_len);
+  const __m512i target_vec = _mm512_set1_epi8(target);
+  for (position_t searched = 0; searched < search_len; searched += 64) {
+    __m512i chunk = _mm512_loadu_si512(labels + pos + searched);
+    uint64_t check_bits = _mm512_cmpgt_epu8_mask(chunk, target_vec);
+    if (search_len - searched < 64) check_bits &= (1ULL << (search_len - searched)) - 1;
+    if (check_bits) {
+      pos += searched + __builtin_ctzll(check_bits);
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace fst
+
+#endif  // CPUDISPATCH_H_
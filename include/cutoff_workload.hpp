@@ -0,0 +1,38 @@
+#ifndef CUTOFFWORKLOAD_H_
+#define CUTOFFWORKLOAD_H_
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "config.hpp"
+
+namespace fst {
+
+// Nanoseconds of one lookup step on a LOUDS-Dense and a LOUDS-Sparse level,
+// see FST::calibrateStepCosts.
+struct StepCosts {
+  double dense_ns{0};
+  double sparse_ns{0};
+};
+
+// Expected lookups for choosing the dense/sparse cutoff level by query cost
+// instead of sparse_dense_ratio, see FST::create. The levels a lookup walks
+// are weighted by its frequency; the cutoff with the lowest expected cost
+// whose estimated size fits memory_budget is taken.
+struct CutoffWorkload {
+  // sample of lookup keys, which need not be stored keys
+  std::vector<std::string> queries;
+  // access counts of the stored keys, indexed like the keys; may be empty
+  std::vector<uint64_t> key_frequencies;
+  // estimated trie bytes without values; the smallest trie is built if no
+  // cutoff fits
+  uint64_t memory_budget{std::numeric_limits<uint64_t>::max()};
+  // measured on this machine if left 0
+  StepCosts step_costs;
+};
+
+}  // namespace fst
+
+#endif  // CUTOFFWORKLOAD_H_
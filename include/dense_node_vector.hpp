@@ -0,0 +1,207 @@
+#ifndef DENSENODEVECTOR_H_
+#define DENSENODEVECTOR_H_
+
+#include <cassert>
+#include <memory>
+#include <vector>
+
+#include "config.hpp"
+#include "popcount.h"
+
+namespace fst {
+
+// Interleaved LOUDS-Dense encoding (enabled with FST_DENSE_INTERLEAVED).
+// Each 256-fanout node is one contiguous, cache-line-aligned record holding
+// its label bitmap, its child indicator bitmap and the cumulative number of
+// labels and children in all preceding nodes. A dense lookup step therefore reads
+// the first cache line (label bitmap and rank counters) and, if the label
+// exists, the adjacent second one (child bitmap) instead of up to six
+// lines spread over two bitvectors and two rank look-up tables.
+class DenseNodeVector {
+ public:
+  static const position_t kWordsPerNode = kFanout / kWordSize;
+
+  struct alignas(64) Node {
+    word_t labels[kWordsPerNode];
+    position_t label_rank;  // number of labels before this node
+    position_t child_rank;  // number of child indicator bits set before this node
+    alignas(64) word_t children[kWordsPerNode];
+  };
+
+  DenseNodeVector() : num_nodes_(0), nodes_(nullptr){};
+
+  DenseNodeVector(const std::vector<std::vector<word_t> > &label_bitmaps_per_level,
+                  const std::vector<std::vector<word_t> > &child_bitmaps_per_level,
+                  const level_t start_level = 0,
+                  level_t end_level = 0 /* non-inclusive */) {
+    if (end_level == 0) end_level = label_bitmaps_per_level.size();
+
+    num_nodes_ = 0;
+    for (level_t level = start_level; level < end_level; level++)
+      num_nodes_ += label_bitmaps_per_level[level].size() / kWordsPerNode;
+    // zeroed, so that the padding after the rank counters is deterministic
+    nodes_ = new Node[num_nodes_]();
+
+    position_t node_num = 0;
+    position_t label_rank = 0;
+    position_t child_rank = 0;
+    for (level_t level = start_level; level < end_level; level++) {
+      const auto &labels = label_bitmaps_per_level[level];
+      const auto &children = child_bitmaps_per_level[level];
+      for (position_t word = 0; word < labels.size(); word += kWordsPerNode) {
+        Node &node = nodes_[node_num];
+        node.label_rank = label_rank;
+        node.child_rank = child_rank;
+        for (position_t i = 0; i < kWordsPerNode; i++) {
+          node.labels[i] = labels[word + i];
+          node.children[i] = children[word + i];
+          label_rank += popcount(node.labels[i]);
+          child_rank += popcount(node.children[i]);
+        }
+        node_num++;
+      }
+    }
+  }
+
+  ~DenseNodeVector() {
+    if (owns_memory_) delete[] nodes_;
+  }
+
+  position_t numNodes() const { return num_nodes_; }
+
+  position_t numBits() const { return num_nodes_ * kFanout; }
+
+  // in bytes
+  position_t nodesSize() const { return num_nodes_ * sizeof(Node); }
+
+  position_t size() const { return sizeof(DenseNodeVector) + nodesSize(); }
+
+  // in bytes, the label and child bitmaps without rank counters and padding
+  position_t bitmapsSize() const { return num_nodes_ * 2 * kWordsPerNode * sizeof(word_t); }
+
+  position_t serializedSize() const {
+    position_t size = sizeof(num_nodes_) + kCacheLinePadSize + nodesSize();
+    sizeAlign(size);
+    return size;
+  }
+
+  bool readLabelBit(const position_t pos) const {
+    return readBit(nodes_[pos / kFanout].labels, pos);
+  }
+
+  bool readChildBit(const position_t pos) const {
+    return readBit(nodes_[pos / kFanout].children, pos);
+  }
+
+  // Same semantics as BitvectorRank::rank on the concatenated bitmaps.
+  position_t labelRank(const position_t pos) const {
+    const Node &node = nodes_[pos / kFanout];
+    return node.label_rank + rankInNode(node.labels, pos);
+  }
+
+  position_t childRank(const position_t pos) const {
+    const Node &node = nodes_[pos / kFanout];
+    return node.child_rank + rankInNode(node.children, pos);
+  }
+
+  // Same semantics as Bitvector::distanceToNextSetBit on the label bitmaps.
+  position_t distanceToNextLabel(position_t pos) const;
+
+  // Same semantics as Bitvector::distanceToPrevSetBit on the label bitmaps.
+  position_t distanceToPrevLabel(position_t pos) const;
+
+  size_t getNumLabelsInNode(position_t node_num, unsigned &label) const;
+
+  void prefetch(const position_t pos) const {
+    const Node *node = nodes_ + pos / kFanout;
+    __builtin_prefetch(node->labels);
+    __builtin_prefetch(node->children);
+  }
+
+  void serialize(char *&dst) const {
+    memcpy(dst, &num_nodes_, sizeof(num_nodes_));
+    dst += sizeof(num_nodes_);
+    align(dst);
+    uint64_t pad = padCacheLineStart(dst);
+    memcpy(dst, nodes_, nodesSize());
+    dst += nodesSize();
+    padCacheLineEnd(dst, pad, true);
+  }
+
+  static std::unique_ptr<DenseNodeVector> deSerialize(char *&src) {
+    auto dnv = std::make_unique<DenseNodeVector>();
+    memcpy(&(dnv->num_nodes_), src, sizeof(dnv->num_nodes_));
+    src += sizeof(dnv->num_nodes_);
+    align(src);
+    uint64_t pad = skipCacheLineStart(src);
+    dnv->nodes_ = reinterpret_cast<Node *>(src);
+    src += dnv->nodesSize();
+    padCacheLineEnd(src, pad);
+    dnv->owns_memory_ = false;
+    return dnv;
+  }
+
+ private:
+  static bool readBit(const word_t *bits, const position_t pos) {
+    position_t offset = pos & (kFanout - 1);
+    return bits[offset / kWordSize] & (kMsbMask >> (offset & (kWordSize - 1)));
+  }
+
+  // number of 1's in bits up to and including the node offset of pos
+  static position_t rankInNode(const word_t *bits, const position_t pos) {
+    position_t offset = pos & (kFanout - 1);
+    position_t word_id = offset / kWordSize;
+    position_t rank = 0;
+    for (position_t i = 0; i < word_id; i++) rank += popcount(bits[i]);
+    return rank + popcount(bits[word_id] >> (kWordSize - 1 - (offset & (kWordSize - 1))));
+  }
+
+  position_t num_nodes_;
+  Node *nodes_;
+  // false after deSerialize: nodes_ points into the serialized data
+  bool owns_memory_{true};
+};
+
+const position_t DenseNodeVector::kWordsPerNode;
+
+position_t DenseNodeVector::distanceToNextLabel(const position_t pos) const {
+  assert(pos < numBits());
+  position_t next = pos + 1;
+  while (next < numBits()) {
+    const word_t *labels = nodes_[next / kFanout].labels;
+    position_t offset = next & (kWordSize - 1);
+    word_t test_bits = labels[(next & (kFanout - 1)) / kWordSize] << offset;
+    if (test_bits > 0) return (next - pos + __builtin_clzll(test_bits));
+    next += kWordSize - offset;
+  }
+  return (numBits() - pos);
+}
+
+position_t DenseNodeVector::distanceToPrevLabel(const position_t pos) const {
+  assert(pos <= numBits());
+  if (pos == 0) return 0;
+  position_t prev = pos;  // exclusive
+  while (prev > 0) {
+    position_t last = prev - 1;
+    const word_t *labels = nodes_[last / kFanout].labels;
+    position_t offset = last & (kWordSize - 1);
+    word_t test_bits = labels[(last & (kFanout - 1)) / kWordSize] >> (kWordSize - 1 - offset);
+    if (test_bits > 0) return (pos - last + __builtin_ctzll(test_bits));
+    prev -= offset + 1;
+  }
+  return (pos + 1);
+}
+
+size_t DenseNodeVector::getNumLabelsInNode(const position_t node_num, unsigned &label) const {
+  size_t num_labels = 0;
+  const word_t *labels = nodes_[node_num].labels;
+  for (position_t i = 0; i < kWordsPerNode; i++) {
+    num_labels += popcount(labels[i]);
+    if (labels[i] > 0) label = __builtin_clzll(labels[i]) + kWordSize * i;
+  }
+  return num_labels;
+}
+
+}  // namespace fst
+
+#endif  // DENSENODEVECTOR_H_
@@ -0,0 +1,128 @@
+#ifndef FIXEDKEYFST_H_
+#define FIXEDKEYFST_H_
+
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "config.hpp"
+#include "fst.hpp"
+
+namespace fst {
+
+// FST over fixed-length unsigned integer keys (uint32_t or uint64_t), stored
+// big-endian in the same LOUDS-Dense and LOUDS-Sparse encodings as FST. The
+// key length is a compile-time constant, so lookupKey is unrolled into one
+// step per key byte: each byte is a constant shift of the key, there are no
+// key length checks, and as fixed-length keys are prefix-free the sparse
+// label search skips no terminators. Only point lookups are specialized:
+// the range seeks convert the key to a string and run the generic FST seek,
+// and iteration uses FST::Iter unchanged. Implicit values are not supported.
+template <typename Int>
+class FixedKeyFST {
+ public:
+  static_assert(std::is_unsigned_v<Int> && (sizeof(Int) == 4 || sizeof(Int) == 8),
+                "FixedKeyFST keys are 32 or 64-bit unsigned integers");
+
+  static const level_t kKeyLength = sizeof(Int);
+
+  //------------------------------------------------------------------
+  // Input keys must be SORTED. As for FST::create, values are indices into
+  // keys, which must outlive the FixedKeyFST for the range seeks.
+  //------------------------------------------------------------------
+  FixedKeyFST(const std::vector<Int> &keys, const std::vector<uint64_t> &values,
+              bool include_dense = kIncludeDense, uint32_t sparse_dense_ratio = kSparseDenseRatio,
+              level_t node_index_levels = kNodeIndexLevels,
+              uint32_t prefilter_bits_per_key = kPrefilterBitsPerKey);
+
+  bool lookupKey(Int key, uint64_t &value) const;
+
+  // not unrolled, see the class comment
+  FST::Iter moveToKeyGreaterThan(Int key, bool inclusive) const {
+    return fst_.moveToKeyGreaterThan(keyToString(key), inclusive);
+  }
+
+  FST::Iter moveToKeyLessThan(Int key, bool inclusive) const {
+    return fst_.moveToKeyLessThan(keyToString(key), inclusive);
+  }
+
+  // the underlying trie, for iteration, statistics and serialization
+  const FST &getFST() const { return fst_; }
+
+  static std::string keyToString(const Int key) {
+    Int word = toBigEndian(key);
+    return std::string(reinterpret_cast<const char *>(&word), kKeyLength);
+  }
+
+ private:
+  template <level_t... kLevels>
+  bool lookupLevels(IntegerKey<Int> key, uint64_t &value, std::integer_sequence<level_t, kLevels...>) const;
+
+  // Returns true once the lookup is resolved; found and value are set then.
+  template <level_t kLevel>
+  bool lookupLevel(IntegerKey<Int> key, position_t &node_num, bool &found, uint64_t &value) const;
+
+  FST fst_;
+};
+
+template <typename Int>
+const level_t FixedKeyFST<Int>::kKeyLength;
+
+template <typename Int>
+FixedKeyFST<Int>::FixedKeyFST(const std::vector<Int> &keys, const std::vector<uint64_t> &values,
+                              const bool include_dense, const uint32_t sparse_dense_ratio,
+                              const level_t node_index_levels, const uint32_t prefilter_bits_per_key) {
+  fst_.create(keys, values, include_dense, sparse_dense_ratio, node_index_levels, prefilter_bits_per_key);
+}
+
+template <typename Int>
+bool FixedKeyFST<Int>::lookupKey(const Int key, uint64_t &value) const {
+  IntegerKey<Int> integer_key{key};
+  if (fst_.prefilter_ && !fst_.prefilter_->mayContain(integer_key)) return false;
+  return lookupLevels(integer_key, value, std::make_integer_sequence<level_t, kKeyLength>());
+}
+
+template <typename Int>
+template <level_t... kLevels>
+bool FixedKeyFST<Int>::lookupLevels(const IntegerKey<Int> key, uint64_t &value,
+                                    std::integer_sequence<level_t, kLevels...>) const {
+  // dense node numbers continue into LOUDS-Sparse, see FST::lookupKeyImpl
+  position_t node_num = 0;
+  bool found = false;
+  (lookupLevel<kLevels>(key, node_num, found, value) || ...);
+  return found;
+}
+
+template <typename Int>
+template <level_t kLevel>
+bool FixedKeyFST<Int>::lookupLevel(const IntegerKey<Int> key, position_t &node_num, bool &found,
+                                   uint64_t &value) const {
+  bool is_leaf = false;
+  const LoudsDense &louds_dense = *fst_.louds_dense_;
+  if (kLevel < louds_dense.getHeight()) {
+    if (!louds_dense.lookupStep(key[kLevel], node_num, is_leaf)) return true;
+    if (is_leaf) {
+      value = louds_dense.getValue(node_num);
+      found = true;
+      return true;
+    }
+#ifdef FST_PREFETCH
+    if constexpr (kLevel + 1 < kKeyLength)
+      if (kLevel + 1 < louds_dense.getHeight()) louds_dense.prefetchLookupStep(node_num, key[kLevel + 1]);
+#endif
+    return false;
+  }
+  const LoudsSparse &louds_sparse = *fst_.louds_sparse_;
+  if (!louds_sparse.lookupFixedStep(key[kLevel], node_num, is_leaf)) return true;
+  if (is_leaf) {
+    value = louds_sparse.getValue(node_num);
+    found = true;
+    return true;
+  }
+  return false;
+}
+
+}  // namespace fst
+
+#endif  // FIXEDKEYFST_H_
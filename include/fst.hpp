@@ -1,15 +1,24 @@
 #ifndef SURF_H_
 #define SURF_H_
 
+#include <chrono>
+#include <random>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <vector>
 #include <span>
 
+#include "arena.hpp"
 #include "config.hpp"
+#include "cutoff_workload.hpp"
 #include "fst_builder.hpp"
+#include "fst_stats.hpp"
 #include "louds_dense.hpp"
 #include "louds_sparse.hpp"
+#include "prefilter.hpp"
+#include "radix_sort.hpp"
 
 namespace fst {
 
@@ -61,6 +70,16 @@ class FST {
   };
 
  public:
+  // which value of equal keys createUnsorted keeps
+  enum class DuplicatePolicy { kKeepFirst, kKeepLast, kError };
+
+  // one change applied by merge(): key is set to value, or removed if erase
+  struct DeltaEntry {
+    std::string key;
+    uint64_t value{0};
+    bool erase{false};
+  };
+
   FST() = default;
 
   //------------------------------------------------------------------
@@ -70,63 +89,146 @@ class FST {
     create(keys, values, kIncludeDense, kSparseDenseRatio);
   }
 
+  // Keys are length-prefixed byte strings at data + offsets[i]; values index
+  // into offsets. The keys are copied only while building, range seeks read
+  // them through offsets and data, which must both outlive the FST.
   FST(const std::vector<uint32_t> &offsets, const std::vector<uint64_t> &values, const uint8_t *data) {
-    keys_.reserve(offsets.size());
+    std::vector<std::string> keys;
+    keys.reserve(offsets.size());
 
     for (auto offset: offsets) {
       uint8_t key_length = data[offset];
-      std::string key(reinterpret_cast<const char *>(data) + offset + 1, key_length);
-      keys_.emplace_back(std::move(key));
+      keys.emplace_back(reinterpret_cast<const char *>(data) + offset + 1, key_length);
     }
 
-    create(keys_, values, kIncludeDense, kSparseDenseRatio);
+    create(keys, values, kIncludeDense, kSparseDenseRatio);
+    setKeyFetcher([&offsets, data](const uint64_t value) {
+      const uint32_t offset = offsets[value];
+      return std::string_view(reinterpret_cast<const char *>(data) + offset + 1, data[offset]);
+    });
   }
 
+  // The keys are stored as their big-endian bytes; the range seeks read
+  // them from keys, which must outlive the FST.
   FST(const std::vector<uint64_t> &keys, const std::vector<uint64_t> &values) {
-    std::vector<std::string> transformed_keys;
-    transformed_keys.reserve(keys.size());
-
-    for (auto key : keys) {
-      uint64_t endian_swapped_word = __builtin_bswap64(key);
-      transformed_keys.emplace_back(std::string(reinterpret_cast<const char *>(&endian_swapped_word), 8));
-    }
-    create(transformed_keys, values, kIncludeDense, kSparseDenseRatio);
+    create(keys, values, kIncludeDense, kSparseDenseRatio);
   }
 
   FST(const std::vector<uint32_t> &keys, const std::vector<uint64_t> &values) {
-    std::vector<std::string> transformed_keys;
-    transformed_keys.reserve(keys.size());
-
-    for (auto key : keys) {
-      uint32_t endian_swapped_word = __builtin_bswap32(key);
-      transformed_keys.emplace_back(std::string(reinterpret_cast<const char *>(&endian_swapped_word), 4));
-    }
-    create(transformed_keys, values, kIncludeDense, kSparseDenseRatio);
+    create(keys, values, kIncludeDense, kSparseDenseRatio);
   }
 
+  // node_index_levels: number of top LOUDS-Sparse levels whose node
+  // positions are stored explicitly, or kNodeIndexAuto (see config.hpp)
+  // prefilter_bits_per_key: size of the negative-lookup prefilter, 0 for none
   FST(const std::vector<std::string> &keys, const std::vector<uint64_t> &values, const bool include_dense,
-      const uint32_t sparse_dense_ratio) {
-    create(keys, values, include_dense, sparse_dense_ratio);
+      const uint32_t sparse_dense_ratio, const level_t node_index_levels = kNodeIndexLevels,
+      const uint32_t prefilter_bits_per_key = kPrefilterBitsPerKey) {
+    create(keys, values, include_dense, sparse_dense_ratio, node_index_levels, prefilter_bits_per_key);
   }
 
   FST(const std::span<KeyPartValue> key_values, const size_t skip_prefix = 0ULL) {
     create(key_values, skip_prefix, kIncludeDense, kSparseDenseRatio);
   }
 
+  // Implicit values: the value of a key is its ordinal among the distinct
+  // keys. LOUDS-Sparse stores no values and derives the ordinal from leaf
+  // counts during the lookup. This is only part of a value-free trie:
+  // LOUDS-Dense still stores a value per leaf, and a sparse leaf still costs
+  // one packed read, of the subtree leaf counts instead of the value, so
+  // lookups save memory but no memory access. Only lookupKey, lookupKeys and
+  // the iterators support this mode; the node-level lookups of the hybrid
+  // trie throw std::logic_error once they reach LOUDS-Sparse. The trie has
+  // no terminator labels, so a key that is a prefix of another would share
+  // its last label with that key's subtree; such key sets throw
+  // std::invalid_argument.
+  explicit FST(const std::vector<std::string> &keys) {
+    create(keys, kIncludeDense, kSparseDenseRatio);
+  }
+
   ~FST() = default;
 
   void create(const std::vector<std::string> &keys, const std::vector<uint64_t> &values, bool include_dense,
-              uint32_t sparse_dense_ratio);
+              uint32_t sparse_dense_ratio, level_t node_index_levels = kNodeIndexLevels,
+              uint32_t prefilter_bits_per_key = kPrefilterBitsPerKey);
 
-  void create(const std::span<KeyPartValue> key_values, level_t skip_prefix, bool include_dense,
-              uint32_t sparse_dense_ratio);
+  void create(const std::vector<std::string> &keys, bool include_dense, uint32_t sparse_dense_ratio,
+              level_t node_index_levels = kNodeIndexLevels, uint32_t prefilter_bits_per_key = kPrefilterBitsPerKey);
 
-  bool lookupKey(const std::string &key, uint64_t &value) const;
+  void create(const std::span<KeyPartValue> key_values, level_t skip_prefix, bool include_dense,
+              uint32_t sparse_dense_ratio, level_t node_index_levels = kNodeIndexLevels);
+
+  // Integer keys (uint32_t or uint64_t) as their big-endian bytes, built
+  // without a string per key, see FSTBuilder::build.
+  template <typename Int>
+  void create(const std::vector<Int> &keys, const std::vector<uint64_t> &values, bool include_dense,
+              uint32_t sparse_dense_ratio, level_t node_index_levels = kNodeIndexLevels,
+              uint32_t prefilter_bits_per_key = kPrefilterBitsPerKey);
+
+  // Keys need not be sorted: they are ordered by a parallel radix sort (see
+  // RadixSorter) and fed to the builder without being copied. Of equal keys
+  // the first or last in input order is kept, or std::invalid_argument is
+  // thrown. As for create(), values are indices into keys.
+  void createUnsorted(const std::vector<std::string> &keys, const std::vector<uint64_t> &values,
+                      DuplicatePolicy duplicates = DuplicatePolicy::kKeepFirst, unsigned num_threads = 1,
+                      bool include_dense = kIncludeDense, uint32_t sparse_dense_ratio = kSparseDenseRatio,
+                      level_t node_index_levels = kNodeIndexLevels,
+                      uint32_t prefilter_bits_per_key = kPrefilterBitsPerKey);
+
+  // Takes the trie of a builder fed by FSTBuilder::add and finished, whose
+  // vectors are released. No keys are known, so the range seeks need
+  // setKeyFetcher and no prefilter is built.
+  void create(FSTBuilder &builder);
+
+  // Builds the trie of base with delta applied, in one pass that walks base
+  // with an iterator and feeds the builder as for create(FSTBuilder &),
+  // without collecting the keys. The full keys of base are read through its
+  // key fetcher, so base must have one. delta must be sorted by key without
+  // repeats, and erasing absent keys is allowed. std::invalid_argument is
+  // thrown, leaving this FST unchanged, if these do not hold or no key is
+  // left. Values are copied unchanged, so the range seeks of the result need
+  // setKeyFetcher; base may be this FST.
+  void merge(const FST &base, const std::vector<DeltaEntry> &delta, bool include_dense = kIncludeDense,
+             uint32_t sparse_dense_ratio = kSparseDenseRatio, level_t node_index_levels = kNodeIndexLevels);
+
+  // Builds the same trie as create() with up to num_threads threads, see
+  // FSTBuilder::buildParallel.
+  void createParallel(const std::vector<std::string> &keys, const std::vector<uint64_t> &values,
+                      unsigned num_threads, bool include_dense = kIncludeDense,
+                      uint32_t sparse_dense_ratio = kSparseDenseRatio, level_t node_index_levels = kNodeIndexLevels,
+                      uint32_t prefilter_bits_per_key = kPrefilterBitsPerKey);
+
+  // Picks the dense/sparse cutoff level for workload instead of by
+  // sparse_dense_ratio, see CutoffWorkload.
+  void create(const std::vector<std::string> &keys, const std::vector<uint64_t> &values,
+              const CutoffWorkload &workload, level_t node_index_levels = kNodeIndexLevels,
+              uint32_t prefilter_bits_per_key = kPrefilterBitsPerKey);
+
+  // Times lookups in an all-dense and an all-sparse trie of random keys once
+  // per process and returns the cost of one step on either encoding.
+  static StepCosts calibrateStepCosts();
+
+  // Replaces the value-to-key mapping of the range seeks. create() maps
+  // values as indices into its keys vector, which must then outlive the
+  // FST; deSerialize() sets none.
+  void setKeyFetcher(const KeyFetcher &fetch_key);
+
+  bool lookupKey(std::string_view key, uint64_t &value) const;
+
+  bool lookupKey(const uint8_t *key, size_t key_length, uint64_t &value) const;
 
   bool lookupKey(uint32_t key, uint64_t &value) const;
 
   bool lookupKey(uint64_t key, uint64_t &value) const;
 
+  // Batched point lookup: runs up to kLookupBatchWindow independent lookups
+  // interleaved, prefetching the next level of each lookup while the others
+  // are resolved. For every key i, bit i of found (see FSTBuilder::setBit)
+  // is set and values[i] is filled in iff lookupKey would return true.
+  // Returns the number of keys found.
+  size_t lookupKeys(std::span<const std::string_view> keys, std::span<uint64_t> values,
+                    std::span<word_t> found) const;
+
   // this function is used by hybrid trie to continue a search started in ARTHybrid
   inline bool lookupKeyAtNode(const char *key, uint64_t key_length, level_t level, size_t node_number,
                               uint64_t &value) const;
@@ -164,94 +266,514 @@ class FST {
 
   uint64_t getMemoryUsage() const;
 
+  // Breakdown of getMemoryUsage() by component and the shape of every
+  // level, for capacity planning and choosing sparse_dense_ratio. Walks all
+  // nodes once.
+  FSTStats getStats() const;
+
+  // peak bytes held while create() ran, see FSTBuilder::getPeakMemoryUsage;
+  // 0 for deserialized FSTs
+  uint64_t getBuildPeakMemoryUsage() const { return build_peak_memory_; }
+
   level_t getHeight() const;
 
   level_t getSparseStartLevel() const;
 
-  const std::vector<uint64_t> &getSparseValues() const;
+  const PackedValueVector &getSparseValues() const;
+
+  const PackedValueVector &getDenseValues() const;
 
-  const std::vector<uint64_t> &getDenseValues() const;
+  // Writes serializedSize() bytes to dst and advances it. The cache-line
+  // padding depends on the address of dst, see padCacheLineStart.
+  void serialize(char *&dst) const;
 
   char *serialize() const {
     uint64_t size = serializedSize();
-    char *data = new char[size];
+    // zeroed, so that the alignment padding is deterministic
+    char *data = new char[size]();
     char *cur_data = data;
-    louds_dense_->serialize(cur_data);
-    louds_sparse_->serialize(cur_data);
+    serialize(cur_data);
     assert(cur_data - data == (int64_t) size);
     return data;
   }
 
+  // Moves all trie arrays into one arena of serializedSize() bytes: the FST
+  // is serialized into the arena and its layers are deserialized in place,
+  // so lookups touch a single huge-page backed (or resource-provided) range
+  // with every cache-line record aligned. The key fetcher is kept; iterators
+  // obtained before the call are invalidated.
+  void compact(Arena::Backing backing = Arena::Backing::kHugePages);
+
+  void compact(std::pmr::memory_resource *resource);
+
+  // Reads an FST written by serialize(). The trie arrays, packed values and
+  // prefilter are used in place, not copied: src must outlive the returned
+  // FST and stay unchanged until it is deleted.
   static FST *deSerialize(char *src) {
     FST *surf = new FST();
     surf->louds_dense_ = LoudsDense::deSerialize(src);
     surf->louds_sparse_ = LoudsSparse::deSerialize(src);
+    auto prefilter = BlockedBloomFilter::deSerialize(src);
+    if (prefilter->numBlocks() > 0) surf->prefilter_ = std::move(prefilter);
     surf->iter_ = FST::Iter(surf);
     return surf;
   }
 
  private:
-  std::vector<std::string> keys_;
+  template <typename Int>
+  friend class FixedKeyFST;
+
+  // state of one in-flight lookup of lookupKeys
+  struct LookupSlot {
+    enum Stage : uint8_t { kFiltered, kDenseStep, kDenseValue, kSparseNode, kSparseStep, kSparseValue };
+
+    std::string_view key;
+    size_t index;
+    level_t level;
+    position_t node_num;  // node number, sparse label position or value index depending on stage
+    Stage stage;
+  };
+
+  // shared point lookup of all lookupKey overloads
+  template <typename Key>
+  bool lookupKeyImpl(const Key &key, uint64_t &value) const;
+
+  // the values of a created FST index keys, which are strings or integers.
+  // If keys holds repeats, distinct lists the index of each key once, and
+  // the prefilter is sized for and fed with those keys only.
+  template <typename Key>
+  void finishCreate(const std::vector<Key> &keys, uint32_t prefilter_bits_per_key,
+                    const std::vector<uint64_t> *distinct = nullptr);
+
+  void compactInto(std::unique_ptr<Arena> arena);
+
+  void startLookup(LookupSlot &slot, std::string_view key, size_t index) const;
+
+  // Advances slot by one stage and prefetches what the next stage reads.
+  // Returns true once the lookup is resolved; found and value are set then.
+  bool advanceLookup(LookupSlot &slot, bool &found, uint64_t &value) const;
+
+  // set by compact(); declared first so the layers pointing into it are
+  // destroyed before it
+  std::unique_ptr<Arena> arena_;
   std::unique_ptr<LoudsSparse> louds_sparse_;
   std::unique_ptr<FSTBuilder> builder_;
   std::unique_ptr<LoudsDense> louds_dense_;
+  // optional, rejects most absent keys before the trie walk
+  std::unique_ptr<BlockedBloomFilter> prefilter_;
+  uint64_t build_peak_memory_{0};
 
   FST::Iter iter_;
   FST::Iter end_;
 };
 
 void FST::create(const std::vector<std::string> &keys, const std::vector<uint64_t> &values, const bool include_dense,
-                 const uint32_t sparse_dense_ratio) {
-  builder_ = std::make_unique<FSTBuilder>(include_dense, sparse_dense_ratio);
+                 const uint32_t sparse_dense_ratio, const level_t node_index_levels,
+                 const uint32_t prefilter_bits_per_key) {
+  builder_ = std::make_unique<FSTBuilder>(include_dense, sparse_dense_ratio, node_index_levels);
+  builder_->build(keys, values);
+  finishCreate(keys, prefilter_bits_per_key);
+}
+
+void FST::create(const std::vector<std::string> &keys, const bool include_dense, const uint32_t sparse_dense_ratio,
+                 const level_t node_index_levels, const uint32_t prefilter_bits_per_key) {
+  // checked before this FST is touched; a prefix sorts right before the
+  // keys it is a prefix of
+  for (size_t i = 0; i + 1 < keys.size(); i++) {
+    if (keys[i].size() < keys[i + 1].size() && keys[i + 1].compare(0, keys[i].size(), keys[i]) == 0)
+      throw std::invalid_argument("implicit values need keys that are no prefix of another key");
+  }
+  builder_ = std::make_unique<FSTBuilder>(include_dense, sparse_dense_ratio, node_index_levels);
+  builder_->build(keys);
+  finishCreate(keys, prefilter_bits_per_key);
+}
+
+void FST::create(FSTBuilder &builder) {
+  louds_dense_ = std::make_unique<LoudsDense>(&builder);
+  louds_sparse_ = std::make_unique<LoudsSparse>(&builder);
+  prefilter_.reset();
+  build_peak_memory_ = builder.getPeakMemoryUsage();
+  iter_ = FST::Iter(this);
+  builder_.reset();
+  arena_.reset();
+}
+
+void FST::createUnsorted(const std::vector<std::string> &keys, const std::vector<uint64_t> &values,
+                         const DuplicatePolicy duplicates, const unsigned num_threads, const bool include_dense,
+                         const uint32_t sparse_dense_ratio, const level_t node_index_levels,
+                         const uint32_t prefilter_bits_per_key) {
+  std::vector<uint64_t> order = RadixSorter(keys, num_threads).sort();
+  // checked before this FST is touched
+  if (duplicates == DuplicatePolicy::kError) {
+    for (uint64_t i = 0; i + 1 < order.size(); i++) {
+      if (keys[order[i]] == keys[order[i + 1]]) throw std::invalid_argument("duplicate key");
+    }
+  }
+  builder_ = std::make_unique<FSTBuilder>(include_dense, sparse_dense_ratio, node_index_levels);
+  // the front of order is overwritten with one index per distinct key,
+  // for the prefilter
+  uint64_t num_distinct = 0;
+  bool repeat = false;
+  for (uint64_t i = 0; i < order.size(); i++) {
+    const uint64_t index = order[i];
+    if (!repeat) order[num_distinct++] = index;
+    // equal keys are adjacent and in input order; the builder keeps the
+    // first one added
+    repeat = i + 1 < order.size() && keys[order[i + 1]] == keys[index];
+    if (repeat && duplicates == DuplicatePolicy::kKeepLast) continue;
+    builder_->add(keys[index], values[index]);
+  }
+  order.resize(num_distinct);
+  builder_->finish();
+  finishCreate(keys, prefilter_bits_per_key, &order);
+}
+
+void FST::merge(const FST &base, const std::vector<DeltaEntry> &delta, const bool include_dense,
+                const uint32_t sparse_dense_ratio, const level_t node_index_levels) {
+  const KeyFetcher &fetch_key = base.louds_dense_->getKeyFetcher();
+  if (!fetch_key) throw std::invalid_argument("merge needs the key fetcher of base");
+  FSTBuilder builder(include_dense, sparse_dense_ratio, node_index_levels);
+  uint64_t num_keys = 0;
+  auto add = [&](const std::string_view key, const uint64_t value) {
+    builder.add(key, value);
+    num_keys++;
+  };
+
+  FST::Iter iter = base.moveToFirst();
+  for (size_t i = 0; i < delta.size(); i++) {
+    if (i > 0 && delta[i].key <= delta[i - 1].key) throw std::invalid_argument("delta keys are not sorted");
+    // base keys before the change are kept, an equal one is replaced
+    for (; iter.isValid(); iter++) {
+      const std::string_view key = fetch_key(iter.getValue());
+      if (key >= delta[i].key) {
+        if (key == delta[i].key) iter++;
+        break;
+      }
+      add(key, iter.getValue());
+    }
+    if (!delta[i].erase) add(delta[i].key, delta[i].value);
+  }
+  for (; iter.isValid(); iter++) add(fetch_key(iter.getValue()), iter.getValue());
+
+  if (num_keys == 0) throw std::invalid_argument("merge leaves no keys");
+  builder.finish();
+  // base is read until here, as it may be this FST
+  create(builder);
+}
+
+void FST::createParallel(const std::vector<std::string> &keys, const std::vector<uint64_t> &values,
+                         const unsigned num_threads, const bool include_dense, const uint32_t sparse_dense_ratio,
+                         const level_t node_index_levels, const uint32_t prefilter_bits_per_key) {
+  builder_ = std::make_unique<FSTBuilder>(include_dense, sparse_dense_ratio, node_index_levels);
+  builder_->buildParallel(keys, values, std::max(num_threads, 1u));
+  finishCreate(keys, prefilter_bits_per_key);
+}
+
+void FST::create(const std::vector<std::string> &keys, const std::vector<uint64_t> &values,
+                 const CutoffWorkload &workload, const level_t node_index_levels,
+                 const uint32_t prefilter_bits_per_key) {
+  CutoffWorkload calibrated;
+  const CutoffWorkload *cutoff_workload = &workload;
+  if (workload.step_costs.dense_ns <= 0 || workload.step_costs.sparse_ns <= 0) {
+    calibrated = workload;
+    calibrated.step_costs = calibrateStepCosts();
+    cutoff_workload = &calibrated;
+  }
+  builder_ = std::make_unique<FSTBuilder>(cutoff_workload, node_index_levels);
+  builder_->build(keys, values);
+  finishCreate(keys, prefilter_bits_per_key);
+}
+
+StepCosts FST::calibrateStepCosts() {
+  static const StepCosts costs = [] {
+    static const size_t kNumKeys = 1 << 15;
+    static const int kRounds = 8;
+    std::mt19937_64 random(kNumKeys);
+    std::vector<std::string> keys;
+    keys.reserve(kNumKeys);
+    for (size_t i = 0; i < kNumKeys; i++) {
+      uint64_t word = random();
+      keys.emplace_back(reinterpret_cast<const char *>(&word), sizeof(word));
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::vector<uint64_t> values(keys.size());
+    for (size_t i = 0; i < values.size(); i++) values[i] = i;
+    std::vector<std::string_view> queries(keys.begin(), keys.end());
+    std::shuffle(queries.begin(), queries.end(), random);
+
+    // ratio 0 keeps every level dense
+    FST dense(keys, values, true, 0, 0, 0);
+    FST sparse(keys, values, false, 0, 0, 0);
+    // a lookup of a stored key takes one step per level down to its leaf
+    FSTStats stats = sparse.getStats();
+    uint64_t steps = 0;
+    for (level_t level = 0; level < stats.height; level++) steps += (level + 1) * stats.levels[level].leaves;
+    auto measure = [&](const FST &fst) {
+      uint64_t sink = 0;
+      auto start = std::chrono::steady_clock::now();
+      for (int round = 0; round < kRounds; round++) {
+        for (std::string_view query : queries) {
+          uint64_t value = 0;
+          fst.lookupKey(query, value);
+          sink += value;
+        }
+      }
+      std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+      // keeps the lookups from being optimized out
+      volatile uint64_t result = sink;
+      (void) result;
+      return std::max(elapsed.count(), 1.0) / (static_cast<double>(steps) * kRounds);
+    };
+    return StepCosts{measure(dense), measure(sparse)};
+  }();
+  return costs;
+}
+
+template <typename Int>
+void FST::create(const std::vector<Int> &keys, const std::vector<uint64_t> &values, const bool include_dense,
+                 const uint32_t sparse_dense_ratio, const level_t node_index_levels,
+                 const uint32_t prefilter_bits_per_key) {
+  builder_ = std::make_unique<FSTBuilder>(include_dense, sparse_dense_ratio, node_index_levels);
   builder_->build(keys, values);
-  louds_dense_ = std::make_unique<LoudsDense>(builder_.get(), keys);
-  louds_sparse_ = std::make_unique<LoudsSparse>(builder_.get(), keys);
+  finishCreate(keys, prefilter_bits_per_key);
+}
+
+template <typename Key>
+void FST::finishCreate(const std::vector<Key> &keys, const uint32_t prefilter_bits_per_key,
+                       const std::vector<uint64_t> *distinct) {
+  KeyFetcher fetch_key;
+  if constexpr (std::is_same_v<Key, std::string>)
+    fetch_key = keyVectorFetcher(&keys);
+  else
+    fetch_key = integerKeyFetcher(&keys);
+  louds_dense_ = std::make_unique<LoudsDense>(builder_.get(), fetch_key);
+  louds_sparse_ = std::make_unique<LoudsSparse>(builder_.get(), fetch_key);
+  if (prefilter_bits_per_key > 0) {
+    if constexpr (std::is_same_v<Key, std::string>) {
+      if (distinct)
+        prefilter_ = std::make_unique<BlockedBloomFilter>(keys, *distinct, prefilter_bits_per_key);
+      else
+        prefilter_ = std::make_unique<BlockedBloomFilter>(keys, prefilter_bits_per_key);
+    } else {
+      prefilter_ = std::make_unique<BlockedBloomFilter>(keys, prefilter_bits_per_key);
+    }
+    builder_->trackFinalMemory(prefilter_->size());
+  } else {
+    prefilter_.reset();
+  }
+  build_peak_memory_ = builder_->getPeakMemoryUsage();
   iter_ = FST::Iter(this);
   builder_.reset();
+  arena_.reset();
 }
 
 void FST::create(const std::span<KeyPartValue> key_values, const level_t skip_prefix, const bool include_dense,
-                 const uint32_t sparse_dense_ratio) {
-  builder_ = std::make_unique<FSTBuilder>(include_dense, sparse_dense_ratio);
+                 const uint32_t sparse_dense_ratio, const level_t node_index_levels) {
+  builder_ = std::make_unique<FSTBuilder>(include_dense, sparse_dense_ratio, node_index_levels);
   builder_->build(key_values, skip_prefix);
   louds_dense_ = std::make_unique<LoudsDense>(builder_.get());
   louds_sparse_ = std::make_unique<LoudsSparse>(builder_.get());
+  // key parts do not hold the full keys, so no prefilter can be built here
+  prefilter_.reset();
+  build_peak_memory_ = builder_->getPeakMemoryUsage();
   iter_ = FST::Iter(this);
   builder_.reset();
+  arena_.reset();
 }
 
-bool FST::lookupKey(const uint32_t key, uint64_t &value) const {
-  // transform uint32 to string
-  uint32_t endian_swapped_word = __builtin_bswap32(key);
-  std::string transformed_key = std::string(reinterpret_cast<const char *>(&endian_swapped_word), 4);
+void FST::setKeyFetcher(const KeyFetcher &fetch_key) {
+  louds_dense_->setKeyFetcher(fetch_key);
+  louds_sparse_->setKeyFetcher(fetch_key);
+}
 
+void FST::serialize(char *&dst) const {
+  louds_dense_->serialize(dst);
+  louds_sparse_->serialize(dst);
+  // an empty filter marks the absence of a prefilter
+  if (prefilter_)
+    prefilter_->serialize(dst);
+  else
+    BlockedBloomFilter().serialize(dst);
+}
+
+void FST::compact(const Arena::Backing backing) {
+  compactInto(std::make_unique<Arena>(serializedSize(), backing));
+}
+
+void FST::compact(std::pmr::memory_resource *resource) {
+  compactInto(std::make_unique<Arena>(serializedSize(), resource));
+}
+
+void FST::compactInto(std::unique_ptr<Arena> arena) {
+  char *dst = arena->data();
+  serialize(dst);
+  assert(dst - arena->data() == (int64_t) arena->size());
+  KeyFetcher fetch_key = louds_dense_->getKeyFetcher();
+
+  char *src = arena->data();
+  louds_dense_ = LoudsDense::deSerialize(src);
+  louds_sparse_ = LoudsSparse::deSerialize(src);
+  auto prefilter = BlockedBloomFilter::deSerialize(src);
+  if (prefilter->numBlocks() > 0)
+    prefilter_ = std::move(prefilter);
+  else
+    prefilter_.reset();
+  // the old layers are gone, so a previous arena can be released now
+  arena_ = std::move(arena);
+  setKeyFetcher(fetch_key);
+  iter_ = FST::Iter(this);
+}
+
+template <typename Key>
+bool FST::lookupKeyImpl(const Key &key, uint64_t &value) const {
+  if (prefilter_ && !prefilter_->mayContain(key)) return false;
   position_t connect_node_num = 0;
-  if (!louds_dense_->lookupKey(transformed_key, connect_node_num, value))
+  if (louds_dense_->getHeight() == 0)  // no dense levels, start at the sparse root
+    return louds_sparse_->lookupKey(key, connect_node_num, value);
+  // implicit values: leaves left of the dense part of the path
+  uint64_t leaves_left = 0;
+  if (!louds_dense_->lookupKey(key, connect_node_num, value,
+                               louds_sparse_->hasImplicitValues() ? &leaves_left : nullptr))
     return false;
   else if (connect_node_num != 0)
-    return louds_sparse_->lookupKey(transformed_key, connect_node_num, value);
+    return louds_sparse_->lookupKey(key, connect_node_num, value, leaves_left);
   return true;
 }
 
+bool FST::lookupKey(const uint32_t key, uint64_t &value) const {
+  return lookupKeyImpl(IntegerKey<uint32_t>{key}, value);
+}
+
 bool FST::lookupKey(const uint64_t key, uint64_t &value) const {
-  // transform uint32 to string
-  uint64_t endian_swapped_word = __builtin_bswap64(key);
-  std::string transformed_key = std::string(reinterpret_cast<const char *>(&endian_swapped_word), 8);
+  return lookupKeyImpl(IntegerKey<uint64_t>{key}, value);
+}
 
-  position_t connect_node_num = 0;
-  if (!louds_dense_->lookupKey(transformed_key, connect_node_num, value))
-    return false;
-  else if (connect_node_num != 0)
-    return louds_sparse_->lookupKey(transformed_key, connect_node_num, value);
-  return true;
+bool FST::lookupKey(const std::string_view key, uint64_t &value) const {
+  return lookupKeyImpl(key, value);
 }
 
-bool FST::lookupKey(const std::string &key, uint64_t &value) const {
-  position_t connect_node_num = 0;
-  if (!louds_dense_->lookupKey(key, connect_node_num, value))
-    return false;
-  else if (connect_node_num != 0)
-    return louds_sparse_->lookupKey(key, connect_node_num, value);
+bool FST::lookupKey(const uint8_t *key, const size_t key_length, uint64_t &value) const {
+  return lookupKeyImpl(std::string_view(reinterpret_cast<const char *>(key), key_length), value);
+}
+
+size_t FST::lookupKeys(const std::span<const std::string_view> keys, const std::span<uint64_t> values,
+                       const std::span<word_t> found) const {
+  assert(values.size() >= keys.size());
+  assert(found.size() * kWordSize >= keys.size());
+  std::fill(found.begin(), found.begin() + (keys.size() + kWordSize - 1) / kWordSize, 0);
+
+  // the interleaved steps do not track the leaf counts implicit values need
+  if (louds_sparse_->hasImplicitValues()) {
+    size_t num_found = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+      if (lookupKey(keys[i], values[i])) {
+        found[i / kWordSize] |= (kMsbMask >> (i % kWordSize));
+        num_found++;
+      }
+    }
+    return num_found;
+  }
+
+  LookupSlot slots[kLookupBatchWindow];
+  uint32_t num_active = 0;
+  size_t next_key = 0;
+  while (num_active < kLookupBatchWindow && next_key < keys.size()) {
+    startLookup(slots[num_active], keys[next_key], next_key);
+    num_active++;
+    next_key++;
+  }
+
+  size_t num_found = 0;
+  // round-robin over the in-flight lookups, refilling finished slots
+  while (num_active > 0) {
+    for (uint32_t i = 0; i < num_active;) {
+      LookupSlot &slot = slots[i];
+      bool is_found = false;
+      uint64_t value = 0;
+      if (!advanceLookup(slot, is_found, value)) {
+        i++;
+        continue;
+      }
+      if (is_found) {
+        values[slot.index] = value;
+        found[slot.index / kWordSize] |= (kMsbMask >> (slot.index % kWordSize));
+        num_found++;
+      }
+      if (next_key < keys.size()) {
+        startLookup(slot, keys[next_key], next_key);
+        next_key++;
+        i++;
+      } else {
+        slot = slots[--num_active];
+      }
+    }
+  }
+  return num_found;
+}
+
+void FST::startLookup(LookupSlot &slot, const std::string_view key, const size_t index) const {
+  slot.key = key;
+  slot.index = index;
+  slot.level = 0;
+  slot.node_num = 0;
+  if (prefilter_ && !prefilter_->mayContain(key)) {
+    slot.stage = LookupSlot::kFiltered;
+  } else if (louds_dense_->getHeight() > 0) {
+    slot.stage = LookupSlot::kDenseStep;
+    if (!key.empty()) louds_dense_->prefetchLookupStep(0, key[0]);
+  } else {
+    slot.stage = LookupSlot::kSparseNode;
+    louds_sparse_->prefetchNode(0);
+  }
+}
+
+bool FST::advanceLookup(LookupSlot &slot, bool &found, uint64_t &value) const {
+  bool is_leaf = false;
+  switch (slot.stage) {
+    case LookupSlot::kFiltered:
+      return true;
+    case LookupSlot::kDenseStep:
+      if (slot.level >= slot.key.length()) return true;  // if run out of searchKey bytes
+      if (!louds_dense_->lookupStep(slot.key[slot.level], slot.node_num, is_leaf)) return true;
+      if (is_leaf) {
+        louds_dense_->prefetchValue(slot.node_num);
+        slot.stage = LookupSlot::kDenseValue;
+        return false;
+      }
+      slot.level++;
+      if (slot.level < louds_dense_->getHeight()) {
+        if (slot.level < slot.key.length()) louds_dense_->prefetchLookupStep(slot.node_num, slot.key[slot.level]);
+      } else {  // search will continue in LoudsSparse
+        louds_sparse_->prefetchNode(slot.node_num);
+        slot.stage = LookupSlot::kSparseNode;
+      }
+      return false;
+    case LookupSlot::kDenseValue:
+      value = louds_dense_->getValue(slot.node_num);
+      found = true;
+      return true;
+    case LookupSlot::kSparseNode:
+      slot.node_num = louds_sparse_->locateNode(slot.node_num);
+      slot.stage = LookupSlot::kSparseStep;
+      return false;
+    case LookupSlot::kSparseStep:
+      if (slot.level >= slot.key.length()) return true;
+      if (!louds_sparse_->lookupStep(slot.key[slot.level], slot.node_num, is_leaf)) return true;
+      if (is_leaf) {
+        louds_sparse_->prefetchValue(slot.node_num);
+        slot.stage = LookupSlot::kSparseValue;
+        return false;
+      }
+      slot.level++;
+      louds_sparse_->prefetchNode(slot.node_num);
+      slot.stage = LookupSlot::kSparseNode;
+      return false;
+    case LookupSlot::kSparseValue:
+      value = louds_sparse_->getValue(slot.node_num);
+      found = true;
+      return true;
+  }
   return true;
 }
 
@@ -421,6 +943,7 @@ FST::Iter FST::moveToFirst() const {
     iter.passToSparse();
     iter.sparse_iter_.moveToLeftMostKey();
   } else {
+    iter.dense_iter_.skip();
     iter.sparse_iter_.setToFirstLabelInRoot();
     iter.sparse_iter_.moveToLeftMostKey();
   }
@@ -436,6 +959,7 @@ FST::Iter FST::moveToLast() const {
     iter.passToSparse();
     iter.sparse_iter_.moveToRightMostKey();
   } else {
+    iter.dense_iter_.skip();
     iter.sparse_iter_.setToLastLabelInRoot();
     iter.sparse_iter_.moveToRightMostKey();
   }
@@ -467,21 +991,38 @@ std::pair<FST::Iter, FST::Iter> FST::lookupRange(const std::string &left_key, co
   return {begin_iter, end_iter};
 }
 
-uint64_t FST::serializedSize() const { return (louds_dense_->serializedSize() + louds_sparse_->serializedSize()); }
+uint64_t FST::serializedSize() const {
+  return (louds_dense_->serializedSize() + louds_sparse_->serializedSize() +
+          (prefilter_ ? prefilter_->serializedSize() : BlockedBloomFilter().serializedSize()));
+}
 
 uint64_t FST::getMemoryUsage() const {
-  return (sizeof(FST) + louds_dense_->getMemoryUsage() + louds_sparse_->getMemoryUsage());
+  return (sizeof(FST) + louds_dense_->getMemoryUsage() + louds_sparse_->getMemoryUsage() +
+          (prefilter_ ? prefilter_->size() : 0));
+}
+
+FSTStats FST::getStats() const {
+  FSTStats stats;
+  stats.height = getHeight();
+  stats.sparse_start_level = getSparseStartLevel();
+  stats.levels.resize(stats.height);
+  louds_dense_->collectStats(stats);
+  louds_sparse_->collectStats(stats);
+  if (prefilter_) stats.prefilter_bytes = prefilter_->blocksSize();
+  stats.total_bytes = getMemoryUsage();
+  stats.other_bytes = stats.total_bytes - stats.componentBytes();
+  return stats;
 }
 
 level_t FST::getHeight() const { return louds_sparse_->getHeight(); }
 
 level_t FST::getSparseStartLevel() const { return louds_sparse_->getStartLevel(); }
 
-const std::vector<uint64_t> &FST::getSparseValues() const {
+const PackedValueVector &FST::getSparseValues() const {
   return this->louds_sparse_->getValues();
 }
 
-const std::vector<uint64_t> &FST::getDenseValues() const {
+const PackedValueVector &FST::getDenseValues() const {
   return this->louds_dense_->getValues();
 }
 
@@ -514,7 +1055,10 @@ std::string FST::Iter::getKey() const {
   return dense_iter_.getKey() + sparse_iter_.getKey();
 }
 
-void FST::Iter::passToSparse() { sparse_iter_.setStartNodeNum(dense_iter_.getSendOutNodeNum()); }
+void FST::Iter::passToSparse() {
+  sparse_iter_.setStartNodeNum(dense_iter_.getSendOutNodeNum());
+  if (sparse_iter_.hasImplicitValues()) sparse_iter_.setDenseLeavesLeft(dense_iter_.leavesLeftOfPath());
+}
 
 bool FST::Iter::incrementDenseIter() {
   if (!dense_iter_.isValid() || dense_iter_.isSkipped()) return false;
@@ -541,7 +1085,7 @@ bool FST::Iter::operator++(int) {
 }
 
 bool FST::Iter::decrementDenseIter() {
-  if (!dense_iter_.isValid()) return false;
+  if (!dense_iter_.isValid() || dense_iter_.isSkipped()) return false;
 
   dense_iter_--;
   if (!dense_iter_.isValid()) return false;
@@ -1,22 +1,38 @@
 #ifndef FSTBUILDER_H_
 #define FSTBUILDER_H_
 
+#include <algorithm>
 #include <cassert>
+#include <span>
+#include <type_traits>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 #include "config.hpp"
+#include "cutoff_workload.hpp"
 #include "hash.hpp"
+#include "packed_value_vector.hpp"
 
 namespace fst {
 
 class FSTBuilder {
  public:
   FSTBuilder() : sparse_start_level_(0) {};
-  explicit FSTBuilder(bool include_dense, uint32_t sparse_dense_ratio)
+  explicit FSTBuilder(bool include_dense, uint32_t sparse_dense_ratio,
+                      level_t node_index_levels = kNodeIndexLevels)
       : include_dense_(include_dense),
         sparse_dense_ratio_(sparse_dense_ratio),
-        sparse_start_level_(0) {};
+        sparse_start_level_(0),
+        node_index_levels_(node_index_levels) {};
+  // Chooses the cutoff level by the expected cost of workload, which must
+  // outlive build() and have its step costs set.
+  FSTBuilder(const CutoffWorkload *workload, level_t node_index_levels = kNodeIndexLevels)
+      : include_dense_(true),
+        sparse_start_level_(0),
+        node_index_levels_(node_index_levels),
+        workload_(workload) {};
 
   ~FSTBuilder() = default;
 
@@ -29,6 +45,31 @@ class FSTBuilder {
 
   void build(const std::span<KeyPartValue> key_values, const level_t skip_prefix);
 
+  // Integer keys (uint32_t or uint64_t) as their big-endian bytes, without
+  // building a string per key: bytes are shifted out of the key and common
+  // prefixes are the leading zero bytes of neighbors XORed.
+  template <typename Int>
+  void build(const std::vector<Int> &keys, const std::vector<uint64_t> &values);
+
+  // Incremental build: add the keys in sorted order, then call finish().
+  // Only the previous key is held besides the trie vectors themselves. A
+  // repeated key keeps the value it was first added with.
+  void add(std::string_view key, uint64_t value);
+
+  void finish();
+
+  // Builds the same vectors as build(keys, values) with up to num_threads
+  // threads. The keys are split into ranges that end at first-byte
+  // boundaries, so every range is a set of root subtrees; the ranges are
+  // built concurrently and their levels concatenated in key order.
+  void buildParallel(const std::vector<std::string> &keys, const std::vector<uint64_t> &values,
+                     unsigned num_threads);
+
+  // Implicit-value build: the value of a key is its ordinal among the
+  // distinct keys. Only the (few) leaves in LOUDS-Dense levels keep it
+  // explicitly; LOUDS-Sparse derives it from leaf counts at lookup time.
+  void build(const std::vector<std::string> &keys);
+
   static bool readBit(const std::vector<word_t> &bits, const position_t pos) {
     assert(pos < (bits.size() * kWordSize));
     position_t word_id = pos / kWordSize;
@@ -65,10 +106,36 @@ class FSTBuilder {
 
   const std::vector<position_t> &getNodeCounts() const { return node_counts_; }
   level_t getSparseStartLevel() const { return sparse_start_level_; }
+  level_t getNodeIndexLevels() const { return node_index_levels_; }
+
+  bool hasImplicitValues() const { return implicit_values_; }
+
+  // number of leaves (keys) ending at each level
+  const std::vector<position_t> &getLeafCounts() const { return leaf_counts_; }
 
-  std::vector<uint64_t> getDenseValues() const { return values_dense_; }
+  // Hand the per-level labels and values to the LabelVector and
+  // PackedValueVector constructors, which free each level they copy.
+  std::vector<std::vector<label_t>> &&releaseLabels() { return std::move(labels_); }
+  std::vector<PackedValueVector> &&releaseValues() { return std::move(values_); }
 
-  std::vector<uint64_t> getSparseValues() const { return values_sparse_; }
+  // Free the per-level bit vectors once their final bitvectors are built.
+  void releaseDenseBitmaps();
+  void releaseChildIndicatorBits() { releaseLevels(child_indicator_bits_); }
+  void releaseLoudsBits() { releaseLevels(louds_bits_); }
+
+  // bytes currently held by the per-level build vectors
+  uint64_t getMemoryUsage() const;
+
+  // Called by LoudsDense and LoudsSparse with the size of each final array
+  // they build, before its source levels are released.
+  void trackFinalMemory(const uint64_t bytes) {
+    final_memory_ += bytes;
+    updatePeakMemory();
+  }
+
+  // Peak of getMemoryUsage() plus the final arrays built so far, sampled
+  // after each build stage.
+  uint64_t getPeakMemoryUsage() const { return peak_memory_; }
 
  private:
   static bool isSameKey(const std::string_view a, const std::string_view b) {
@@ -84,7 +151,8 @@ class FSTBuilder {
   // Fill in the LOUDS-Sparse vectors through a single scan
   // of the sorted key list.
   void buildSparse(const std::vector<std::string> &keys,
-                   const std::vector<uint64_t> &values);
+                   const std::vector<uint64_t> &values,
+                   position_t begin, position_t end);
 
   void buildSparse(std::span<KeyPartValue> key_values, level_t skip_prefix);
 
@@ -94,19 +162,42 @@ class FSTBuilder {
   // label vector.
   // For each matching prefix byte(label), it sets the corresponding
   // child indicator bit to 1 for that label.
-  level_t skipCommonPrefix(const std::string &key, level_t skip_prefix = 0);
+  level_t skipCommonPrefix(std::string_view key, level_t skip_prefix = 0);
 
   // Starting at the start_level of the trie, the function inserts
   // key bytes to the trie vectors until the first byte/label where
   // key and next_key do not match.
   // This function is called after skipCommonPrefix. Therefore, it
   // guarantees that the stored prefix of key is unique in the trie.
-  level_t insertKeyBytesToTrieUntilUnique(const std::string &key,
+  level_t insertKeyBytesToTrieUntilUnique(std::string_view key,
                                           uint64_t position,
-                                          const std::string &next_key,
+                                          std::string_view next_key,
                                           level_t start_level,
                                           level_t skip_prefix = 0);
 
+  // Appends the levels of the builders of consecutive key ranges. Their
+  // root nodes are merged into one.
+  void stitchPartitions(std::vector<FSTBuilder> &parts, unsigned num_threads);
+
+  // Copies src_bits bits of src to bit dst_bits of dst, which is large enough.
+  static void appendBits(std::vector<word_t> &dst, position_t dst_bits, const std::vector<word_t> &src,
+                         position_t src_bits);
+
+  template <typename Int>
+  static label_t keyByte(const Int key, const level_t level) {
+    return static_cast<label_t>(key >> (8 * (sizeof(Int) - 1 - level)));
+  }
+
+  // number of equal leading bytes of two different keys
+  template <typename Int>
+  static level_t commonPrefixBytes(const Int a, const Int b) {
+    assert(a != b);
+    if constexpr (sizeof(Int) == 8)
+      return __builtin_clzll(a ^ b) / 8;
+    else
+      return __builtin_clz(a ^ b) / 8;
+  }
+
   inline bool isCharCommonPrefix(label_t c, level_t level) const;
   inline bool isLevelEmpty(level_t level) const;
   inline void moveToNextItemSlot(level_t level);
@@ -118,6 +209,63 @@ class FSTBuilder {
   // Dense size < Sparse size / sparse_dense_ratio_
   inline void determineCutoffLevel();
 
+  // Compute sparse_start_level_ with the lowest expected lookup cost of
+  // workload_ among the levels whose estimated size fits its budget.
+  void determineWorkloadCutoffLevel(const std::vector<std::string> &keys);
+
+  // Number of levels a lookup of query walks, i.e. the depth of the leaf or
+  // missing label it ends at; keys are the sorted build keys.
+  level_t lookupDepth(const std::vector<std::string> &keys, std::string_view query) const;
+  level_t storedKeyDepth(const std::vector<std::string> &keys, position_t i) const;
+
+  // computeDenseMem and computeSparseMem weigh the dense levels for the
+  // ratio; this is an estimate in bytes
+  uint64_t estimateMemory(level_t cutoff_level) const;
+
+  // Fills leaf_counts_ from the per-level values.
+  void countLeaves();
+
+  // Shared end of all builds: picks the cutoff level, builds the dense
+  // levels and counts the leaves. A workload needs the string keys; without
+  // them the cutoff follows sparse_dense_ratio_.
+  void finishLevels(const std::vector<std::string> *keys);
+
+  template <typename T>
+  static void releaseLevel(std::vector<T> &level) {
+    std::vector<T>().swap(level);
+  }
+
+  template <typename T>
+  static void releaseLevels(std::vector<std::vector<T>> &levels) {
+    for (auto &level : levels) releaseLevel(level);
+  }
+
+  static void releaseLevel(PackedValueVector &level) { level = PackedValueVector(); }
+
+  template <typename T>
+  static uint64_t levelsMemory(const std::vector<std::vector<T>> &levels) {
+    uint64_t mem = levels.capacity() * sizeof(std::vector<T>);
+    for (const auto &level : levels) mem += level.capacity() * sizeof(T);
+    return mem;
+  }
+
+  static uint64_t levelsMemory(const std::vector<PackedValueVector> &levels) {
+    uint64_t mem = (levels.capacity() - levels.size()) * sizeof(PackedValueVector);
+    for (const auto &level : levels) mem += level.allocatedSize();
+    return mem;
+  }
+
+  // Sets the bit width the per-level values start with, from the largest
+  // value to be inserted. A wider value later repacks its level.
+  template <typename Values>
+  void initValueWidth(const Values &values) {
+    uint64_t max_value = 0;
+    for (const auto &value : values) max_value |= value;
+    value_width_ = PackedValueVector::bitWidth(max_value);
+  }
+
+  void updatePeakMemory() { peak_memory_ = std::max(peak_memory_, getMemoryUsage() + final_memory_); }
+
   inline uint64_t computeDenseMem(level_t downto_level) const;
   inline uint64_t computeSparseMem(level_t start_level) const;
 
@@ -142,56 +290,218 @@ class FSTBuilder {
   bool include_dense_{};
   uint32_t sparse_dense_ratio_{};
   level_t sparse_start_level_;
-
-  std::vector<std::vector<uint64_t>> values_;
+  // number of top LOUDS-Sparse levels with an explicit node index
+  level_t node_index_levels_{kNodeIndexLevels};
+  // values are key ordinals and not stored for LOUDS-Sparse
+  bool implicit_values_{false};
+  // the last key passed to add(), inserted once its successor is known
+  std::string pending_key_;
+  uint64_t pending_value_{0};
+  bool has_pending_key_{false};
+  const CutoffWorkload *workload_{nullptr};
+
+  // packed as they are inserted, value_width_ bits each until a value needs
+  // more
+  std::vector<PackedValueVector> values_;
+  uint32_t value_width_{1};
+  std::vector<position_t> leaf_counts_;
 
   // LOUDS-Sparse bit/byte vectors
   std::vector<std::vector<label_t>> labels_;
   std::vector<std::vector<word_t>> child_indicator_bits_;
   std::vector<std::vector<word_t>> louds_bits_;
-  std::vector<uint64_t> values_sparse_;
 
   // LOUDS-Dense bit vectors
   std::vector<std::vector<word_t>> bitmap_labels_;
   std::vector<std::vector<word_t>> bitmap_child_indicator_bits_;
   std::vector<std::vector<word_t>> prefixkey_indicator_bits_;
-  std::vector<uint64_t> values_dense_;
 
   // auxiliary per level bookkeeping vectors
   std::vector<position_t> node_counts_;
   std::vector<bool> is_last_item_terminator_;
+
+  // bytes of the final arrays built from this builder so far
+  uint64_t final_memory_{0};
+  uint64_t peak_memory_{0};
 };
 
 void FSTBuilder::build(const std::vector<std::string> &keys,
                        const std::vector<uint64_t> &values) {
   assert(keys.size() > 0);
-  buildSparse(keys, values);
-  if (include_dense_) {
-    determineCutoffLevel();
-    buildDense();
-  }
+  initValueWidth(values);
+  buildSparse(keys, values, 0, keys.size());
+  finishLevels(&keys);
+}
+
+void FSTBuilder::build(const std::vector<std::string> &keys) {
+  assert(keys.size() > 0);
+  implicit_values_ = true;
+  value_width_ = PackedValueVector::bitWidth(keys.size());
+  buildSparse(keys, std::vector<uint64_t>(), 0, keys.size());
+  finishLevels(&keys);
 }
 
 void FSTBuilder::build(const std::span<KeyPartValue> key_values, const level_t skip_prefix) {
   assert(key_values.size() > 0);
+  uint64_t max_value = 0;
+  for (const KeyPartValue &key_value : key_values) max_value |= key_value.value;
+  value_width_ = PackedValueVector::bitWidth(max_value);
   buildSparse(key_values, skip_prefix);
-  if (include_dense_) {
-    determineCutoffLevel();
-    buildDense();
+  finishLevels(nullptr);
+}
+
+template <typename Int>
+void FSTBuilder::build(const std::vector<Int> &keys, const std::vector<uint64_t> &values) {
+  static_assert(std::is_unsigned_v<Int> && (sizeof(Int) == 4 || sizeof(Int) == 8),
+                "integer keys are 32 or 64-bit unsigned integers");
+  assert(keys.size() > 0);
+  initValueWidth(values);
+  // the same steps as buildSparse: the levels shared with the previous key
+  // are skipped, then the key is inserted until it differs from the next
+  // one. The shared levels already have their child bits set, as the
+  // previous key was inserted down to the level after them.
+  level_t level = 0;
+  for (position_t i = 0; i < keys.size(); i++) {
+    position_t curpos = i;
+    while (i + 1 < keys.size() && keys[curpos] == keys[i + 1]) i++;
+    level_t depth = level + 1;
+    level_t next_level = 0;
+    if (i + 1 < keys.size()) {
+      next_level = commonPrefixBytes(keys[curpos], keys[i + 1]);
+      depth = std::max<level_t>(depth, next_level + 1);
+    }
+    insertKeyByte(keyByte(keys[curpos], level), level, isLevelEmpty(level), false);
+    for (level_t l = level + 1; l < depth; l++) insertKeyByte(keyByte(keys[curpos], l), l, true, false);
+    values_[depth - 1].push_back(values[curpos]);
+    level = next_level;
+  }
+  finishLevels(nullptr);
+}
+
+void FSTBuilder::add(const std::string_view key, const uint64_t value) {
+  if (has_pending_key_) {
+    assert(pending_key_ <= key);
+    if (key == pending_key_) return;
+    level_t level = skipCommonPrefix(pending_key_);
+    insertKeyBytesToTrieUntilUnique(pending_key_, pending_value_, key, level);
+  }
+  pending_key_.assign(key);
+  pending_value_ = value;
+  has_pending_key_ = true;
+}
+
+void FSTBuilder::finish() {
+  assert(has_pending_key_);
+  level_t level = skipCommonPrefix(pending_key_);
+  insertKeyBytesToTrieUntilUnique(pending_key_, pending_value_, std::string_view(), level);
+  std::string().swap(pending_key_);
+  has_pending_key_ = false;
+  finishLevels(nullptr);
+}
+
+void FSTBuilder::buildParallel(const std::vector<std::string> &keys, const std::vector<uint64_t> &values,
+                               const unsigned num_threads) {
+  assert(keys.size() > 0);
+  initValueWidth(values);
+  // range ends, moved forward to the next change of the first byte
+  std::vector<position_t> ends;
+  for (unsigned t = 1; t <= num_threads; t++) {
+    position_t end = std::max<position_t>(keys.size() * t / num_threads, ends.empty() ? 1 : ends.back());
+    while (end < keys.size() && keys[end][0] == keys[end - 1][0]) end++;
+    if (ends.empty() || end > ends.back()) ends.push_back(end);
+    if (end == keys.size()) break;
+  }
+
+  std::vector<FSTBuilder> parts(ends.size());
+  for (auto &part : parts) part.value_width_ = value_width_;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < parts.size(); i++) {
+    threads.emplace_back([&, i] { parts[i].buildSparse(keys, values, i == 0 ? 0 : ends[i - 1], ends[i]); });
+  }
+  for (auto &thread : threads) thread.join();
+  uint64_t parts_memory = 0;
+  for (const auto &part : parts) parts_memory += part.getMemoryUsage();
+  peak_memory_ = std::max(peak_memory_, parts_memory);
+
+  stitchPartitions(parts, num_threads);
+  finishLevels(&keys);
+}
+
+void FSTBuilder::stitchPartitions(std::vector<FSTBuilder> &parts, const unsigned num_threads) {
+  level_t height = 0;
+  for (const auto &part : parts) height = std::max(height, part.getTreeHeight());
+  while (getTreeHeight() < height) addLevel();
+
+  auto stitchLevel = [&](const level_t level) {
+    position_t num_items = 0;
+    for (const auto &part : parts) {
+      if (level < part.getTreeHeight()) num_items += part.getNumItems(level);
+    }
+    labels_[level].reserve(num_items);
+    child_indicator_bits_[level].assign(num_items / kWordSize + 2, 0);
+    louds_bits_[level].assign(num_items / kWordSize + 2, 0);
+    position_t pos = 0;
+    for (auto &part : parts) {
+      if (level >= part.getTreeHeight()) continue;
+      position_t part_items = part.getNumItems(level);
+      labels_[level].insert(labels_[level].end(), part.labels_[level].begin(), part.labels_[level].end());
+      values_[level].append(part.values_[level]);
+      appendBits(child_indicator_bits_[level], pos, part.child_indicator_bits_[level], part_items);
+      appendBits(louds_bits_[level], pos, part.louds_bits_[level], part_items);
+      node_counts_[level] += part.node_counts_[level];
+      is_last_item_terminator_[level] = part.is_last_item_terminator_[level];
+      // the root nodes of the later ranges continue the first one
+      if (level == 0 && pos > 0) {
+        louds_bits_[level][pos / kWordSize] &= ~(kMsbMask >> (pos % kWordSize));
+        node_counts_[level]--;
+      }
+      pos += part_items;
+      releaseLevel(part.labels_[level]);
+      releaseLevel(part.values_[level]);
+      releaseLevel(part.child_indicator_bits_[level]);
+      releaseLevel(part.louds_bits_[level]);
+    }
+    // one word more than the items need, as moveToNextItemSlot keeps it
+    child_indicator_bits_[level].resize(num_items / kWordSize + 1);
+    louds_bits_[level].resize(num_items / kWordSize + 1);
+  };
+
+  // the levels are independent
+  std::vector<std::thread> threads;
+  unsigned num_workers = std::max(1u, std::min<unsigned>(num_threads, height));
+  for (unsigned worker = 0; worker < num_workers; worker++) {
+    threads.emplace_back([&, worker] {
+      for (level_t level = worker; level < height; level += num_workers) stitchLevel(level);
+    });
+  }
+  for (auto &thread : threads) thread.join();
+}
+
+void FSTBuilder::appendBits(std::vector<word_t> &dst, const position_t dst_bits, const std::vector<word_t> &src,
+                            const position_t src_bits) {
+  position_t word_id = dst_bits / kWordSize;
+  position_t shift = dst_bits % kWordSize;
+  // bits past src_bits are 0
+  for (position_t i = 0; i * kWordSize < src_bits; i++, word_id++) {
+    dst[word_id] |= src[i] >> shift;
+    if (shift > 0) dst[word_id + 1] |= src[i] << (kWordSize - shift);
   }
 }
 
 void FSTBuilder::buildSparse(const std::vector<std::string> &keys,
-                             const std::vector<uint64_t> &values) {
-  for (position_t i = 0; i < keys.size(); i++) {
+                             const std::vector<uint64_t> &values,
+                             const position_t begin, const position_t end) {
+  uint64_t ordinal = 0;
+  for (position_t i = begin; i < end; i++) {
     level_t level = skipCommonPrefix(keys[i]);
     position_t curpos = i;
-    while ((i + 1 < keys.size()) && isSameKey(keys[curpos], keys[i + 1])) i++;
-    if (i < keys.size() - 1)
-      insertKeyBytesToTrieUntilUnique(keys[curpos], values[curpos], keys[i + 1],
+    while ((i + 1 < end) && isSameKey(keys[curpos], keys[i + 1])) i++;
+    uint64_t value = implicit_values_ ? ordinal++ : values[curpos];
+    if (i < end - 1)
+      insertKeyBytesToTrieUntilUnique(keys[curpos], value, keys[i + 1],
                                       level);
     else  // for last key, there is no successor key in the list
-      insertKeyBytesToTrieUntilUnique(keys[curpos], values[curpos], std::string(),
+      insertKeyBytesToTrieUntilUnique(keys[curpos], value, std::string(),
                                       level);
   }
 }
@@ -210,7 +520,7 @@ void FSTBuilder::buildSparse(const std::span<KeyPartValue> key_values, const lev
   }
 }
 
-level_t FSTBuilder::skipCommonPrefix(const std::string &key, level_t skip_prefix) {
+level_t FSTBuilder::skipCommonPrefix(const std::string_view key, level_t skip_prefix) {
   level_t level = 0;
   while (level + skip_prefix < key.length() &&
       isCharCommonPrefix((label_t) key[level + skip_prefix], level)) {
@@ -222,9 +532,9 @@ level_t FSTBuilder::skipCommonPrefix(const std::string &key, level_t skip_prefix
 }
 
 level_t FSTBuilder::insertKeyBytesToTrieUntilUnique(
-    const std::string &key,
+    const std::string_view key,
     const uint64_t value,
-    const std::string &next_key,
+    const std::string_view next_key,
     const level_t start_level,
     const level_t skip_prefix) {
   assert(start_level + skip_prefix < key.length());
@@ -244,7 +554,7 @@ level_t FSTBuilder::insertKeyBytesToTrieUntilUnique(
 
   if (level + skip_prefix > next_key.length()
       || !isSameKey({key.begin() + skip_prefix, key.begin() + skip_prefix + level}, {next_key.begin() + skip_prefix, next_key.begin() + skip_prefix + level})) {
-    values_[level - 1].emplace_back(value);
+    values_[level - 1].push_back(value);
     return level;
   }
 
@@ -256,7 +566,7 @@ level_t FSTBuilder::insertKeyBytesToTrieUntilUnique(
     insertKeyByte(key[level + skip_prefix], level, is_start_of_node, is_term);
     level++;
   }
-  values_[level - 1].emplace_back(value);
+  values_[level - 1].push_back(value);
   return level;
 }
 
@@ -313,19 +623,124 @@ inline void FSTBuilder::determineCutoffLevel() {
   }
   // cutoff_level = 3;
   sparse_start_level_ = cutoff_level--;
+}
 
-  // CA build dense and sparse values vectors
-  for (uint64_t level = 0; level < sparse_start_level_; level++) {
-    values_dense_.insert(values_dense_.end(), values_[level].begin(),
-                            values_[level].end());
+void FSTBuilder::determineWorkloadCutoffLevel(const std::vector<std::string> &keys) {
+  // reach[level]: weighted number of lookups that step through level
+  std::vector<double> reach(getTreeHeight() + 1, 0);
+  auto addLookup = [&](const level_t depth, const double weight) {
+    reach[0] += weight;
+    reach[depth] -= weight;
+  };
+  for (const std::string &query : workload_->queries) addLookup(lookupDepth(keys, query), 1);
+  for (position_t i = 0; i < workload_->key_frequencies.size() && i < keys.size(); i++)
+    addLookup(storedKeyDepth(keys, i), workload_->key_frequencies[i]);
+  for (level_t level = 1; level < reach.size(); level++) reach[level] += reach[level - 1];
+
+  const StepCosts &costs = workload_->step_costs;
+  // every level starts sparse, moving the cutoff down turns one into dense
+  double cost = 0;
+  for (level_t level = 0; level < getTreeHeight(); level++) cost += reach[level] * costs.sparse_ns;
+  std::vector<double> level_costs(1, cost);
+  for (level_t level = 0; level < getTreeHeight(); level++) {
+    cost += reach[level] * (costs.dense_ns - costs.sparse_ns);
+    level_costs.push_back(cost);
   }
 
-  for (uint64_t level = sparse_start_level_; level < values_.size();
-       level++) {
-    values_sparse_.insert(values_sparse_.end(), values_[level].begin(),
-                             values_[level].end());
+  level_t best_level = 0;
+  uint64_t best_mem = estimateMemory(0);
+  bool best_fits = best_mem <= workload_->memory_budget;
+  for (level_t level = 1; level <= getTreeHeight(); level++) {
+    uint64_t mem = estimateMemory(level);
+    bool fits = mem <= workload_->memory_budget;
+    if (!fits) {
+      if (!best_fits && mem < best_mem) {
+        best_level = level;
+        best_mem = mem;
+      }
+      continue;
+    }
+    // dense levels no lookup gains from are not worth their memory
+    bool cheaper = level_costs[level] < level_costs[best_level] * (1 - kCutoffCostTolerance);
+    bool as_cheap = level_costs[level] <= level_costs[best_level] * (1 + kCutoffCostTolerance);
+    if (!best_fits || cheaper || (as_cheap && mem < best_mem)) {
+      best_level = level;
+      best_mem = mem;
+      best_fits = true;
+    }
   }
-  values_.clear();
+  sparse_start_level_ = best_level;
+}
+
+level_t FSTBuilder::storedKeyDepth(const std::vector<std::string> &keys, const position_t i) const {
+  // a key is stored up to the first byte that differs from its neighbors
+  size_t prefix = 0;
+  for (position_t j : {i - 1, i + 1}) {
+    if (j >= keys.size()) continue;
+    const std::string &other = keys[j];
+    size_t common = std::mismatch(keys[i].begin(), keys[i].begin() + std::min(keys[i].size(), other.size()),
+                                  other.begin()).first - keys[i].begin();
+    // also if one key is a prefix of the other, its terminator or last
+    // label is one level further down
+    prefix = std::max(prefix, common + 1);
+  }
+  return std::clamp<size_t>(prefix, 1, getTreeHeight());
+}
+
+level_t FSTBuilder::lookupDepth(const std::vector<std::string> &keys, const std::string_view query) const {
+  auto it = std::lower_bound(keys.begin(), keys.end(), query);
+  position_t i = it - keys.begin();
+  if (it != keys.end() && *it == query) return storedKeyDepth(keys, i);
+  // the lookup follows the longest common prefix with a neighbor, but stops
+  // at the leaf of that neighbor
+  level_t depth = 1;
+  for (position_t j : {i - 1, i}) {
+    if (j >= keys.size()) continue;
+    const std::string &other = keys[j];
+    size_t common = std::mismatch(query.begin(), query.begin() + std::min(query.size(), other.size()),
+                                  other.begin()).first - query.begin();
+    depth = std::max<level_t>(depth, std::min<size_t>({common + 1, query.size(), storedKeyDepth(keys, j)}));
+  }
+  return depth;
+}
+
+uint64_t FSTBuilder::estimateMemory(const level_t cutoff_level) const {
+  uint64_t mem = computeSparseMem(cutoff_level);
+  for (level_t level = 0; level < cutoff_level; level++) {
+    // label and child indicator bitmaps plus the prefix key bit of a node
+    mem += 2 * kFanout / 8 * static_cast<uint64_t>(node_counts_[level]) + node_counts_[level] / 8 + 1;
+  }
+  return mem;
+}
+
+void FSTBuilder::finishLevels(const std::vector<std::string> *keys) {
+  updatePeakMemory();
+  if (include_dense_) {
+    if (workload_ && keys)
+      determineWorkloadCutoffLevel(*keys);
+    else
+      determineCutoffLevel();
+    buildDense();
+    updatePeakMemory();
+  }
+  countLeaves();
+}
+
+void FSTBuilder::countLeaves() {
+  leaf_counts_.clear();
+  for (const auto &level_values : values_) leaf_counts_.push_back(level_values.numValues());
+}
+
+void FSTBuilder::releaseDenseBitmaps() {
+  releaseLevels(bitmap_labels_);
+  releaseLevels(bitmap_child_indicator_bits_);
+  releaseLevels(prefixkey_indicator_bits_);
+}
+
+uint64_t FSTBuilder::getMemoryUsage() const {
+  return levelsMemory(values_) + levelsMemory(labels_) + levelsMemory(child_indicator_bits_) +
+      levelsMemory(louds_bits_) + levelsMemory(bitmap_labels_) + levelsMemory(bitmap_child_indicator_bits_) +
+      levelsMemory(prefixkey_indicator_bits_);
 }
 
 inline uint64_t FSTBuilder::computeDenseMem(const level_t downto_level) const {
@@ -395,7 +810,7 @@ void FSTBuilder::setLabelAndChildIndicatorBitmap(const level_t level,
 
 void FSTBuilder::addLevel() {
   labels_.emplace_back(std::vector<label_t>());
-  values_.emplace_back(std::vector<uint64_t>());
+  values_.emplace_back(value_width_);
   child_indicator_bits_.emplace_back(std::vector<word_t>());
   louds_bits_.emplace_back(std::vector<word_t>());
 
@@ -0,0 +1,73 @@
+#ifndef FSTSTATS_H_
+#define FSTSTATS_H_
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "config.hpp"
+
+namespace fst {
+
+// Shape of one trie level, see FST::getStats.
+struct FSTLevelStats {
+  position_t nodes{0};
+  // labels plus prefix keys (LOUDS-Dense) or terminators (LOUDS-Sparse)
+  position_t items{0};
+  // values stored on this level
+  position_t leaves{0};
+  // label, child indicator and prefix key bits of a LOUDS-Dense level,
+  // without word padding and rank LUTs; 0 on LOUDS-Sparse levels
+  uint64_t dense_bitmap_bytes{0};
+};
+
+// Memory and shape breakdown of an FST, see FST::getStats. All sizes are in
+// bytes. The components add up to total_bytes, which equals
+// FST::getMemoryUsage().
+struct FSTStats {
+  // LOUDS-Sparse label bytes, including the SIMD search padding
+  uint64_t labels_bytes{0};
+  // LOUDS-Sparse child indicator bits, without their rank directory
+  uint64_t child_bits_bytes{0};
+  // LOUDS-Sparse node boundary bits, without their select inventory
+  uint64_t louds_bits_bytes{0};
+  // LOUDS-Dense label, child indicator and prefix key bitmaps of all levels
+  uint64_t dense_bitmap_bytes{0};
+  // rank LUTs of the dense bitmaps (or the rank counters and padding of the
+  // interleaved dense nodes) and the sparse child bits rank directory
+  uint64_t rank_lut_bytes{0};
+  // select inventory of the LOUDS-Sparse node boundary bits
+  uint64_t select_lut_bytes{0};
+  uint64_t dense_values_bytes{0};
+  // with implicit values, the subtree leaf counts the ordinals are read from
+  uint64_t sparse_values_bytes{0};
+  // explicit node positions of the top sparse levels
+  uint64_t node_index_bytes{0};
+  uint64_t prefilter_bytes{0};
+  // object headers, leaf offsets and other per-level metadata
+  uint64_t other_bytes{0};
+  uint64_t total_bytes{0};
+
+  level_t height{0};
+  // the first LOUDS-Sparse level; levels above it are LOUDS-Dense
+  level_t sparse_start_level{0};
+  // indexed by level, height entries
+  std::vector<FSTLevelStats> levels;
+  // fanout_histogram[i] is the number of nodes with i items; a node holds
+  // at most kFanout labels and a prefix key or terminator
+  std::vector<uint64_t> fanout_histogram = std::vector<uint64_t>(kFanout + 2, 0);
+
+  void addNode(const position_t items) {
+    assert(items < fanout_histogram.size());
+    fanout_histogram[items]++;
+  }
+
+  uint64_t componentBytes() const {
+    return labels_bytes + child_bits_bytes + louds_bits_bytes + dense_bitmap_bytes + rank_lut_bytes +
+           select_lut_bytes + dense_values_bytes + sparse_values_bytes + node_index_bytes + prefilter_bytes;
+  }
+};
+
+}  // namespace fst
+
+#endif  // FSTSTATS_H_
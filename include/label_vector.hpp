@@ -2,14 +2,18 @@
 #define LABELVECTOR_H_
 
 #include <emmintrin.h>
+#include <memory>
 #include <vector>
 
 #include "config.hpp"
+#include "cpu_dispatch.hpp"
 
 namespace fst {
 
 class LabelVector {
  public:
+  static const position_t kPadding = CpuDispatch::kLabelPadding;
+
   LabelVector() : num_bytes_(0), labels_(nullptr){};
 
   explicit LabelVector(const std::vector<std::vector<label_t> > &labels_per_level,
@@ -21,7 +25,8 @@ class LabelVector {
     for (level_t level = start_level; level < end_level; level++)
       num_bytes_ += labels_per_level[level].size();
 
-    labels_ = new label_t[num_bytes_];
+    // zeroed padding keeps whole-vector loads at the end of the array in bounds
+    labels_ = new label_t[num_bytes_ + kPadding]();
 
     position_t pos = 0;
     for (level_t level = start_level; level < end_level; level++) {
@@ -32,24 +37,46 @@ class LabelVector {
     }
   }
 
+  // Like the constructor above, but frees each level of labels_per_level
+  // in [start_level, end_level) right after it is copied.
+  LabelVector(std::vector<std::vector<label_t> > &&labels_per_level, const level_t start_level,
+              const level_t end_level) {
+    num_bytes_ = 1;
+    for (level_t level = start_level; level < end_level; level++)
+      num_bytes_ += labels_per_level[level].size();
+    labels_ = new label_t[num_bytes_ + kPadding]();
+
+    position_t pos = 0;
+    for (level_t level = start_level; level < end_level; level++) {
+      memcpy(labels_ + pos, labels_per_level[level].data(), labels_per_level[level].size());
+      pos += labels_per_level[level].size();
+      std::vector<label_t>().swap(labels_per_level[level]);
+    }
+  }
+
   ~LabelVector() {
-    delete[] labels_;
+    if (owns_memory_) delete[] labels_;
   }
 
   position_t getNumBytes() const { return num_bytes_; }
 
   position_t serializedSize() const {
-    position_t size = sizeof(num_bytes_) + num_bytes_;
+    position_t size = sizeof(num_bytes_) + num_bytes_ + kPadding;
     sizeAlign(size);
     return size;
   }
 
-  position_t size() const { return (sizeof(LabelVector) + num_bytes_); }
+  position_t size() const { return (sizeof(LabelVector) + num_bytes_ + kPadding); }
 
   label_t read(const position_t pos) const { return labels_[pos]; }
 
   label_t operator[](const position_t pos) const { return labels_[pos]; }
 
+  void prefetch(const position_t pos) const { __builtin_prefetch(labels_ + pos); }
+
+  // kSkipTerminator = false drops the check for a leading terminator label,
+  // which prefix-free key sets such as fixed-length integers never store
+  template <bool kSkipTerminator = true>
   bool search(label_t target, position_t &pos, position_t search_len) const;
   bool searchGreaterThan(label_t target, position_t &pos,
                          position_t search_len) const;
@@ -57,6 +84,8 @@ class LabelVector {
   bool binarySearch(label_t target, position_t &pos,
                     position_t search_len) const;
   bool simdSearch(label_t target, position_t &pos, position_t search_len) const;
+  bool simdSearchGreaterThan(label_t target, position_t &pos,
+                             position_t search_len) const;
   bool linearSearch(label_t target, position_t &pos,
                     position_t search_len) const;
 
@@ -68,8 +97,8 @@ class LabelVector {
   void serialize(char *&dst) const {
     memcpy(dst, &num_bytes_, sizeof(num_bytes_));
     dst += sizeof(num_bytes_);
-    memcpy(dst, labels_, num_bytes_);
-    dst += num_bytes_;
+    memcpy(dst, labels_, num_bytes_ + kPadding);
+    dst += num_bytes_ + kPadding;
     align(dst);
   }
 
@@ -78,8 +107,9 @@ class LabelVector {
     memcpy(&(lv->num_bytes_), src, sizeof(lv->num_bytes_));
     src += sizeof(lv->num_bytes_);
     lv->labels_ = const_cast<label_t *>(reinterpret_cast<const label_t *>(src));
-    src += lv->num_bytes_;
+    src += lv->num_bytes_ + kPadding;
     align(src);
+    lv->owns_memory_ = false;
     return lv;
   }
 
@@ -90,19 +120,24 @@ class LabelVector {
  private:
   position_t num_bytes_;
   label_t *labels_;
+  // false after deSerialize: labels_ points into the serialized data
+  bool owns_memory_{true};
 };
 
+const position_t LabelVector::kPadding;
+
+template <bool kSkipTerminator>
 bool LabelVector::search(const label_t target, position_t &pos,
                          position_t search_len) const {
   // skip terminator label
-  if ((search_len > 1) && (labels_[pos] == kTerminator)) {
+  if (kSkipTerminator && (search_len > 1) && (labels_[pos] == kTerminator)) {
     pos++;
     search_len--;
   }
 
   if (search_len < 3) return linearSearch(target, pos, search_len);
-  if (search_len < 12)
-    return binarySearch(target, pos, search_len);
+  if (search_len <= 16)
+    return CpuDispatch::labelSearch16(labels_, target, pos, search_len);
   else
     return simdSearch(target, pos, search_len);
 }
@@ -117,8 +152,10 @@ bool LabelVector::searchGreaterThan(const label_t target, position_t &pos,
 
   if (search_len < 3)
     return linearSearchGreaterThan(target, pos, search_len);
+  if (search_len <= 16)
+    return CpuDispatch::labelSearchGreaterThan16(labels_, target, pos, search_len);
   else
-    return binarySearchGreaterThan(target, pos, search_len);
+    return simdSearchGreaterThan(target, pos, search_len);
 }
 
 bool LabelVector::binarySearch(const label_t target, position_t &pos,
@@ -141,36 +178,12 @@ bool LabelVector::binarySearch(const label_t target, position_t &pos,
 
 bool LabelVector::simdSearch(const label_t target, position_t &pos,
                              const position_t search_len) const {
-  // CA: todo fix invalid read
-  position_t num_labels_searched = 0;
-  position_t num_labels_left = search_len;
-  while ((num_labels_left >> 4) > 0 && pos + num_labels_searched + 15 < num_bytes_) { // while at least 16 elements remain and a 16 byte simd read is safe
-    // check that we are still allowed to read
-    label_t *start_ptr = labels_ + pos + num_labels_searched;
-    assert(num_bytes_ - reinterpret_cast<uintptr_t>(start_ptr) + reinterpret_cast<uintptr_t>(labels_) >= 16); // needs to be safe to read 16 bytes from start_ptr
-    __m128i cmp =
-        _mm_cmpeq_epi8(_mm_set1_epi8(target),
-                       _mm_loadu_si128(reinterpret_cast<__m128i *>(start_ptr)));
-    unsigned check_bits = _mm_movemask_epi8(cmp);
-    if (check_bits) {
-      pos += (num_labels_searched + __builtin_ctz(check_bits));
-      return true;
-    }
-    num_labels_searched += 16;
-    num_labels_left -= 16;
-  }
-
-  while (num_labels_left > 0) {
-    assert(pos + num_labels_searched < num_bytes_);
-    if (labels_[pos + num_labels_searched] == target) {
-      pos += num_labels_searched;
-      return true;
-    }
-    ++num_labels_searched;
-    --num_labels_left;
-  }
+  return CpuDispatch::labelSearch(labels_, target, pos, search_len);
+}
 
-  return false;
+bool LabelVector::simdSearchGreaterThan(const label_t target, position_t &pos,
+                                        const position_t search_len) const {
+  return CpuDispatch::labelSearchGreaterThan(labels_, target, pos, search_len);
 }
 
 bool LabelVector::linearSearch(const label_t target, position_t &pos,
@@ -4,7 +4,10 @@
 #include <string>
 
 #include "config.hpp"
+#include "dense_node_vector.hpp"
 #include "fst_builder.hpp"
+#include "fst_stats.hpp"
+#include "packed_value_vector.hpp"
 #include "rank.hpp"
 
 namespace fst {
@@ -85,6 +88,10 @@ class LoudsDense {
 
     uint64_t getValue() const;
 
+    // number of leaves left of the path at the levels the iterator spans;
+    // every level of the path must continue to a child
+    uint64_t leavesLeftOfPath() const;
+
     void rankValuePosition(size_t pos);
 
     void operator++(int);
@@ -134,17 +141,35 @@ class LoudsDense {
  public:
   LoudsDense() = default;
 
-  LoudsDense(FSTBuilder *builder,
-             const std::vector<std::string> &keys);
-
-  LoudsDense(FSTBuilder *builder, const std::vector<std::string> *keys_ptr = nullptr);
+  LoudsDense(FSTBuilder *builder, KeyFetcher fetch_key = KeyFetcher());
 
   ~LoudsDense() = default;
 
   // Returns whether key exists in the trie so far
   // out_node_num == 0 means search terminates in louds-dense.
-  bool lookupKey(const std::string &key, position_t &out_node_num,
-                 uint64_t &value) const;
+  // Key is a std::string_view or an IntegerKey.
+  // If leaves_left is given and the search continues in louds-sparse, the
+  // number of leaves left of the search path is added to it.
+  template <typename Key>
+  bool lookupKey(const Key &key, position_t &out_node_num,
+                 uint64_t &value, uint64_t *leaves_left = nullptr) const;
+
+  // Single-level step of a point lookup, used by FST::lookupKeys to
+  // interleave independent lookups. Returns false if label does not exist
+  // in node node_num. Otherwise, node_num is set to the child node number,
+  // or to the value index if the branch terminates (is_leaf).
+  bool lookupStep(label_t label, position_t &node_num, bool &is_leaf) const;
+
+  // prefetches the bitmap words and rank blocks read by lookupStep
+  void prefetchLookupStep(position_t node_num, label_t label) const;
+
+  void prefetchValue(position_t value_index) const {
+    values_dense_.prefetch(value_index);
+  }
+
+  uint64_t getValue(position_t value_index) const {
+    return values_dense_[value_index];
+  }
 
   // this function checks if the FST node has only one branch
   bool nodeHasMultipleBranchesOrTerminates(size_t &nodeNumber, size_t level, std::vector<uint8_t> &prefixLabels) const;
@@ -177,15 +202,33 @@ class LoudsDense {
 
   uint64_t getMemoryUsage() const;
 
-  [[nodiscard]] const std::vector<uint64_t> &getValues() const;
+  // Adds the sizes and the level shapes of the dense levels to stats, whose
+  // levels must be sized already.
+  void collectStats(FSTStats &stats) const;
+
+  // the fetcher is not serialized, deserialized tries need it set again
+  void setKeyFetcher(KeyFetcher fetch_key) { fetch_key_ = std::move(fetch_key); }
+
+  const KeyFetcher &getKeyFetcher() const { return fetch_key_; }
+
+  [[nodiscard]] const PackedValueVector &getValues() const;
 
   void serialize(char *&dst) const {
     memcpy(dst, &height_, sizeof(height_));
     dst += sizeof(height_);
+    memcpy(dst, leaf_offsets_.data(), (height_ + 1) * sizeof(position_t));
+    dst += (height_ + 1) * sizeof(position_t);
+    memcpy(dst, node_offsets_.data(), (height_ + 1) * sizeof(position_t));
+    dst += (height_ + 1) * sizeof(position_t);
     align(dst);
+#ifdef FST_DENSE_INTERLEAVED
+    nodes_->serialize(dst);
+#else
     label_bitmaps_->serialize(dst);
     child_indicator_bitmaps_->serialize(dst);
+#endif
     prefixkey_indicator_bits_->serialize(dst);
+    values_dense_.serialize(dst);
     align(dst);
   }
 
@@ -193,17 +236,45 @@ class LoudsDense {
     std::unique_ptr<LoudsDense> louds_dense = std::make_unique<LoudsDense>();
     memcpy(&(louds_dense->height_), src, sizeof(louds_dense->height_));
     src += sizeof(louds_dense->height_);
+    const position_t *leaf_offsets = reinterpret_cast<const position_t *>(src);
+    louds_dense->leaf_offsets_.assign(leaf_offsets, leaf_offsets + louds_dense->height_ + 1);
+    src += (louds_dense->height_ + 1) * sizeof(position_t);
+    const position_t *node_offsets = reinterpret_cast<const position_t *>(src);
+    louds_dense->node_offsets_.assign(node_offsets, node_offsets + louds_dense->height_ + 1);
+    src += (louds_dense->height_ + 1) * sizeof(position_t);
     align(src);
+#ifdef FST_DENSE_INTERLEAVED
+    louds_dense->nodes_ = DenseNodeVector::deSerialize(src);
+#else
     louds_dense->label_bitmaps_ = BitvectorRank::deSerialize(src);
     louds_dense->child_indicator_bitmaps_ = BitvectorRank::deSerialize(src);
+#endif
     louds_dense->prefixkey_indicator_bits_ = BitvectorRank::deSerialize(src);
+    louds_dense->values_dense_ = PackedValueVector::deSerialize(src);
     align(src);
     return louds_dense;
   }
 
  private:
+  // accessors of the label and child indicator bitmaps, backed by either two
+  // rank bitvectors or the interleaved DenseNodeVector
+  bool hasLabel(position_t pos) const;
+
+  bool hasChild(position_t pos) const;
+
+  position_t labelRank(position_t pos) const;
+
+  position_t childRank(position_t pos) const;
+
+  size_t getNumLabelsInNode(position_t node_num, unsigned &label) const;
+
+  void prefetchBitmaps(position_t pos) const;
+
   position_t getChildNodeNum(position_t pos) const;
 
+  // number of leaves at level left of pos; pos must have a child
+  position_t leavesBefore(level_t level, position_t pos) const;
+
   position_t getSuffixPos(position_t pos, bool is_prefix_key) const;
 
   position_t getNextPos(position_t pos) const;
@@ -214,24 +285,37 @@ class LoudsDense {
   static const position_t kNodeFanout = 256;
   static const position_t kRankBasicBlockSize = 512;
 
-  std::vector<uint64_t> values_dense_;
+  PackedValueVector values_dense_;
 
   level_t height_{};
 
+#ifdef FST_DENSE_INTERLEAVED
+  std::unique_ptr<DenseNodeVector> nodes_;
+#else
   std::unique_ptr<BitvectorRank> label_bitmaps_;
   std::unique_ptr<BitvectorRank> child_indicator_bitmaps_;
+#endif
   std::unique_ptr<BitvectorRank> prefixkey_indicator_bits_;
-  // const pointer to the original keys
-  const std::vector<std::string> *keys_{};
+  // number of leaves in the levels above each level, plus the total
+  std::vector<position_t> leaf_offsets_;
+  // number of nodes in the levels above each level, plus the total
+  std::vector<position_t> node_offsets_;
+  // resolves values to keys for the range seeks
+  KeyFetcher fetch_key_;
 };
 
 const position_t LoudsDense::kNodeFanout;
 const position_t LoudsDense::kRankBasicBlockSize;
 
-LoudsDense::LoudsDense(FSTBuilder *builder, const std::vector<std::string> &keys) : LoudsDense(builder, &keys) {}
-
-LoudsDense::LoudsDense(FSTBuilder *builder, const std::vector<std::string> *keys_ptr) : keys_(keys_ptr) {
+LoudsDense::LoudsDense(FSTBuilder *builder, KeyFetcher fetch_key) : fetch_key_(std::move(fetch_key)) {
   height_ = builder->getSparseStartLevel();
+#ifdef FST_DENSE_INTERLEAVED
+  nodes_ = std::make_unique<DenseNodeVector>(builder->getBitmapLabels(),
+                                             builder->getBitmapChildIndicatorBits(),
+                                             0,
+                                             height_);
+  builder->trackFinalMemory(nodes_->size());
+#else
   std::vector<position_t> num_bits_per_level;
   for (level_t level = 0; level < height_; level++)
     num_bits_per_level.push_back(builder->getBitmapLabels()[level].size() * kWordSize);
@@ -247,20 +331,32 @@ LoudsDense::LoudsDense(FSTBuilder *builder, const std::vector<std::string> *keys
                                       num_bits_per_level,
                                       0,
                                       height_);
+  builder->trackFinalMemory(label_bitmaps_->size() + child_indicator_bitmaps_->size());
+#endif
   prefixkey_indicator_bits_ =
       std::make_unique<BitvectorRank>(kRankBasicBlockSize,
                                       builder->getPrefixkeyIndicatorBits(),
                                       builder->getNodeCounts(),
                                       0,
                                       height_);
+  builder->trackFinalMemory(prefixkey_indicator_bits_->size());
+  builder->releaseDenseBitmaps();
+
+  leaf_offsets_.assign(1, 0);
+  for (level_t level = 0; level < height_; level++)
+    leaf_offsets_.push_back(leaf_offsets_.back() + builder->getLeafCounts()[level]);
+  node_offsets_.assign(1, 0);
+  for (level_t level = 0; level < height_; level++)
+    node_offsets_.push_back(node_offsets_.back() + builder->getNodeCounts()[level]);
 
-  // todo make more efficient by completely moving this vector
-  values_dense_ = builder->getDenseValues();
+  values_dense_ = PackedValueVector(builder->releaseValues(), 0, height_);
+  builder->trackFinalMemory(values_dense_.size());
 }
 
 
-bool LoudsDense::lookupKey(const std::string &key, position_t &out_node_num,
-                           uint64_t &value) const {
+template <typename Key>
+bool LoudsDense::lookupKey(const Key &key, position_t &out_node_num,
+                           uint64_t &value, uint64_t *leaves_left) const {
   position_t node_num = 0;
   position_t pos = 0;
   for (level_t level = 0; level < height_; level++) {
@@ -270,15 +366,13 @@ bool LoudsDense::lookupKey(const std::string &key, position_t &out_node_num,
     }
     pos += (label_t) key[level];
 
-    // child_indicator_bitmaps_->prefetch(pos);
-
-    if (!label_bitmaps_->readBit(pos)) {  // if key byte does not exist
+    if (!hasLabel(pos)) {  // if key byte does not exist
       return false;
     }
 
-    if (!child_indicator_bitmaps_->readBit(pos)) {  // if trie branch terminates
-      uint64_t value_index = label_bitmaps_->rank(pos) -
-          child_indicator_bitmaps_->rank(pos) -
+    if (!hasChild(pos)) {  // if trie branch terminates
+      uint64_t value_index = labelRank(pos) -
+          childRank(pos) -
           1;  // + prefix but we do not support this so far
       value = values_dense_[value_index];
 
@@ -286,13 +380,38 @@ bool LoudsDense::lookupKey(const std::string &key, position_t &out_node_num,
       // return (*keys_)[value] == key;
       return true;
     }
+    if (leaves_left != nullptr) *leaves_left += leavesBefore(level, pos);
     node_num = getChildNodeNum(pos);
+#ifdef FST_PREFETCH
+    // issue the loads of the next level together instead of one after the
+    // other as hasLabel, hasChild and the rank lookups are evaluated
+    if (level + 1 < height_ && level + 1 < key.length())
+      prefetchBitmaps(node_num * kNodeFanout + (label_t) key[level + 1]);
+#endif
   }
   // search will continue in LoudsSparse
   out_node_num = node_num;
   return true;
 }
 
+bool LoudsDense::lookupStep(const label_t label, position_t &node_num,
+                            bool &is_leaf) const {
+  position_t pos = node_num * kNodeFanout + label;
+  if (!hasLabel(pos)) return false;
+  is_leaf = !hasChild(pos);
+  if (is_leaf)
+    node_num = labelRank(pos) - childRank(pos) - 1;
+  else
+    node_num = getChildNodeNum(pos);
+  return true;
+}
+
+void LoudsDense::prefetchLookupStep(const position_t node_num,
+                                    const label_t label) const {
+  position_t pos = node_num * kNodeFanout + label;
+  prefetchBitmaps(pos);
+}
+
 inline bool LoudsDense::lookupKeyAtNode(const char *key,
                                         uint64_t key_length,
                                         level_t level,
@@ -306,13 +425,13 @@ inline bool LoudsDense::lookupKeyAtNode(const char *key,
     }
     pos += (label_t) key[level];
 
-    if (!label_bitmaps_->readBit(pos)) {  // if key byte does not exist
+    if (!hasLabel(pos)) {  // if key byte does not exist
       return false;
     }
 
-    if (!child_indicator_bitmaps_->readBit(pos)) {  // if trie branch terminates
-      uint64_t value_index = label_bitmaps_->rank(pos) -
-          child_indicator_bitmaps_->rank(pos) -
+    if (!hasChild(pos)) {  // if trie branch terminates
+      uint64_t value_index = labelRank(pos) -
+          childRank(pos) -
           1;  // + prefix but we do not support this so far
       value = values_dense_[value_index];
 
@@ -322,6 +441,10 @@ inline bool LoudsDense::lookupKeyAtNode(const char *key,
       return true;
     }
     node_num = getChildNodeNum(pos);
+#ifdef FST_PREFETCH
+    if (level + 1 < height_ && level + 1 < key_length)
+      prefetchBitmaps(node_num * kNodeFanout + (label_t) key[level + 1]);
+#endif
   }
   // search will continue in LoudsSparse
   return true;
@@ -334,11 +457,11 @@ bool LoudsDense::nodeHasMultipleBranchesOrTerminates(size_t &nodeNumber,
                                                      size_t level,
                                                      std::vector<uint8_t> &prefixLabels) const {
   unsigned label = 0;
-  assert(label_bitmaps_->getNumSetBitsInDenseNode(nodeNumber, label) > 0);
-  if (label_bitmaps_->getNumSetBitsInDenseNode(nodeNumber, label) == 1) {
+  assert(getNumLabelsInNode(nodeNumber, label) > 0);
+  if (getNumLabelsInNode(nodeNumber, label) == 1) {
     // node has only one label
     position_t pos = (nodeNumber * kNodeFanout) + label;
-    if (!child_indicator_bitmaps_->readBit(pos)) // branch terminates
+    if (!hasChild(pos)) // branch terminates
       return true;
     prefixLabels.emplace_back(label);
     nodeNumber = getChildNodeNum(pos);
@@ -350,17 +473,16 @@ bool LoudsDense::nodeHasMultipleBranchesOrTerminates(size_t &nodeNumber,
 
 void LoudsDense::getNode(size_t nodeNumber, std::vector<uint8_t> &labels, std::vector<uint64_t> &values) {
   position_t pos = (nodeNumber * kNodeFanout);
-  label_bitmaps_->prefetch(pos);
-  child_indicator_bitmaps_->prefetch(pos);
+  prefetchBitmaps(pos);
   for (size_t i = 0; i < 256; i++) {
-    if (label_bitmaps_->readBit(pos + i)) {
+    if (hasLabel(pos + i)) {
       labels.push_back(i);
-      if (child_indicator_bitmaps_->readBit(pos + i)) { // label leads to child node
+      if (hasChild(pos + i)) { // label leads to child node
         // inline information in value that it is a FST node Number
         values.emplace_back(getChildNodeNum(pos + i) << 2U | 3U);
       } else {
         // there is a value, push it back and create an ART leaf node
-        uint64_t value_index = label_bitmaps_->rank(pos + i) - child_indicator_bitmaps_->rank(pos + i) - 1;
+        uint64_t value_index = labelRank(pos + i) - childRank(pos + i) - 1;
         auto value = values_dense_[value_index];
         values.emplace_back((value << 2U) | 1U);
       }
@@ -381,8 +503,8 @@ bool LoudsDense::lookupNodeNumber(const char *key, uint64_t key_length, position
     }
     pos += (label_t) key[level];
 
-    assert(label_bitmaps_->readBit(pos)); // assert that key exists
-    assert(child_indicator_bitmaps_->readBit(pos)); // assert branch does not terminate
+    assert(hasLabel(pos)); // assert that key exists
+    assert(hasChild(pos)); // assert branch does not terminate
 
     node_num = getChildNodeNum(pos);
   }
@@ -406,8 +528,8 @@ std::pair<bool, bool> LoudsDense::lookupNodeNumberOption(const char *key, uint64
     }
     pos += reinterpret_cast<const uint8_t *>(key)[level];
 
-    if (!label_bitmaps_->readBit(pos)) return {false, false}; // does key exists?
-    if (!child_indicator_bitmaps_->readBit(pos)) return {false, false}; // does branch not terminate?
+    if (!hasLabel(pos)) return {false, false}; // does key exists?
+    if (!hasChild(pos)) return {false, false}; // does branch not terminate?
 
     node_num = getChildNodeNum(pos);
   }
@@ -426,14 +548,14 @@ std::pair<bool, bool> LoudsDense::lookupNodeNumberOption(const char *key, uint64
 //  - return false
 bool LoudsDense::findNextNodeOrValue(const char keyByte, size_t &node_number) const {
   position_t pos = (node_number * kNodeFanout) + keyByte;
-  if (!label_bitmaps_->readBit(pos)) { // key not immanent
+  if (!hasLabel(pos)) { // key not immanent
     return false;
   }
   // key exists
-  if (!child_indicator_bitmaps_->readBit(pos)) { // branch terminates
+  if (!hasChild(pos)) { // branch terminates
     uint64_t value_index =
-        label_bitmaps_->rank(pos) -
-            child_indicator_bitmaps_->rank(pos) - 1;
+        labelRank(pos) -
+            childRank(pos) - 1;
     node_number = (values_dense_[value_index] << 2u) | 1u;
   } else { // branch continues
     node_number = (getChildNodeNum(pos) << 2u) | 3u;
@@ -464,17 +586,18 @@ void LoudsDense::moveToKeyGreaterThanStartingNodeNumber(position_t node_num,
     iter.append(pos);
 
     // if no exact match
-    if (!label_bitmaps_->readBit(pos)) {
+    if (!hasLabel(pos)) {
       iter.moveToLeftMostKey(); // search could continue in sparse levels
       return;
     }
 
     // if trie branch terminates
-    if (!child_indicator_bitmaps_->readBit(pos)) {
+    if (!hasChild(pos)) {
       iter.rankValuePosition(pos);
-      auto found_key = (*keys_)[iter.getValue()];
+      // without a key fetcher, conservatively stay at the key prefix
+      std::string_view found_key = fetch_key_ ? fetch_key_(iter.getValue()) : std::string_view();
 
-      if (found_key > searched_key) {
+      if (!fetch_key_ || found_key > searched_key) {
         iter.setFlags(true, true, true, true);
       } else if (found_key < searched_key) {
         iter++; // no exact match, inclusive flag is not relevant
@@ -521,17 +644,18 @@ void LoudsDense::moveToKeyGreaterThan(const std::string &searched_key,
     iter.append(pos);
 
     // if no exact match
-    if (!label_bitmaps_->readBit(pos)) {
+    if (!hasLabel(pos)) {
       iter.moveToLeftMostKey(); // search could continue in sparse levels
       return;
     }
 
     // if trie branch terminates
-    if (!child_indicator_bitmaps_->readBit(pos)) {
+    if (!hasChild(pos)) {
       iter.rankValuePosition(pos);
-      auto found_key = (*keys_)[iter.getValue()];
+      // without a key fetcher, conservatively stay at the key prefix
+      std::string_view found_key = fetch_key_ ? fetch_key_(iter.getValue()) : std::string_view();
 
-      if (found_key > searched_key) {
+      if (!fetch_key_ || found_key > searched_key) {
         iter.setFlags(true, true, true, true);
       } else if (found_key < searched_key) {
         iter++; // no exact match, inclusive flag is not relevant
@@ -555,46 +679,130 @@ void LoudsDense::moveToKeyGreaterThan(const std::string &searched_key,
 }
 
 uint64_t LoudsDense::serializedSize() const {
-  uint64_t size = sizeof(height_) + label_bitmaps_->serializedSize() +
-      child_indicator_bitmaps_->serializedSize() +
-      prefixkey_indicator_bits_->serializedSize();
+  // the header is aligned before the bitvectors
+  uint64_t size = sizeof(height_) + 2 * (height_ + 1) * sizeof(position_t);
+  sizeAlign(size);
+#ifdef FST_DENSE_INTERLEAVED
+  size += nodes_->serializedSize() + prefixkey_indicator_bits_->serializedSize() + values_dense_.serializedSize();
+#else
+  size += label_bitmaps_->serializedSize() + child_indicator_bitmaps_->serializedSize() +
+      prefixkey_indicator_bits_->serializedSize() + values_dense_.serializedSize();
+#endif
   sizeAlign(size);
   return size;
 }
 
-const std::vector<uint64_t> &LoudsDense::getValues() const {
+const PackedValueVector &LoudsDense::getValues() const {
   return values_dense_;
 }
 
 uint64_t LoudsDense::getMemoryUsage() const {
+#ifdef FST_DENSE_INTERLEAVED
+  return (sizeof(LoudsDense) + nodes_->size() + prefixkey_indicator_bits_->size()
+      + (leaf_offsets_.size() + node_offsets_.size()) * sizeof(position_t) + values_dense_.size());
+#else
   return (sizeof(LoudsDense) + label_bitmaps_->size() +
       child_indicator_bitmaps_->size() + prefixkey_indicator_bits_->size()
-      + values_dense_.size() * 8);
+      + (leaf_offsets_.size() + node_offsets_.size()) * sizeof(position_t) + values_dense_.size());
+#endif
+}
+
+void LoudsDense::collectStats(FSTStats &stats) const {
+#ifdef FST_DENSE_INTERLEAVED
+  stats.dense_bitmap_bytes += nodes_->bitmapsSize() + prefixkey_indicator_bits_->bitsSize();
+  stats.rank_lut_bytes += nodes_->nodesSize() - nodes_->bitmapsSize() + prefixkey_indicator_bits_->rankLutSize();
+#else
+  stats.dense_bitmap_bytes += label_bitmaps_->bitsSize() + child_indicator_bitmaps_->bitsSize() +
+      prefixkey_indicator_bits_->bitsSize();
+  stats.rank_lut_bytes += label_bitmaps_->rankLutSize() + child_indicator_bitmaps_->rankLutSize() +
+      prefixkey_indicator_bits_->rankLutSize();
+#endif
+  stats.dense_values_bytes += values_dense_.size() - sizeof(PackedValueVector);
+
+  for (level_t level = 0; level < height_; level++) {
+    FSTLevelStats &level_stats = stats.levels[level];
+    level_stats.nodes = node_offsets_[level + 1] - node_offsets_[level];
+    level_stats.leaves = leaf_offsets_[level + 1] - leaf_offsets_[level];
+    level_stats.dense_bitmap_bytes = level_stats.nodes * 2 * kNodeFanout / 8 + (level_stats.nodes + 7) / 8;
+    for (position_t node_num = node_offsets_[level]; node_num < node_offsets_[level + 1]; node_num++) {
+      position_t items = prefixkey_indicator_bits_->readBit(node_num) ? 1 : 0;
+      for (position_t pos = node_num * kNodeFanout; pos < (node_num + 1) * kNodeFanout; pos++)
+        if (hasLabel(pos)) items++;
+      level_stats.items += items;
+      stats.addNode(items);
+    }
+  }
+}
+
+#ifdef FST_DENSE_INTERLEAVED
+bool LoudsDense::hasLabel(const position_t pos) const { return nodes_->readLabelBit(pos); }
+
+bool LoudsDense::hasChild(const position_t pos) const { return nodes_->readChildBit(pos); }
+
+position_t LoudsDense::labelRank(const position_t pos) const { return nodes_->labelRank(pos); }
+
+position_t LoudsDense::childRank(const position_t pos) const { return nodes_->childRank(pos); }
+
+size_t LoudsDense::getNumLabelsInNode(const position_t node_num, unsigned &label) const {
+  return nodes_->getNumLabelsInNode(node_num, label);
+}
+
+void LoudsDense::prefetchBitmaps(const position_t pos) const { nodes_->prefetch(pos); }
+#else
+bool LoudsDense::hasLabel(const position_t pos) const { return label_bitmaps_->readBit(pos); }
+
+bool LoudsDense::hasChild(const position_t pos) const { return child_indicator_bitmaps_->readBit(pos); }
+
+position_t LoudsDense::labelRank(const position_t pos) const { return label_bitmaps_->rank(pos); }
+
+position_t LoudsDense::childRank(const position_t pos) const { return child_indicator_bitmaps_->rank(pos); }
+
+size_t LoudsDense::getNumLabelsInNode(const position_t node_num, unsigned &label) const {
+  return label_bitmaps_->getNumSetBitsInDenseNode(node_num, label);
+}
+
+void LoudsDense::prefetchBitmaps(const position_t pos) const {
+  label_bitmaps_->prefetch(pos);
+  child_indicator_bitmaps_->prefetch(pos);
 }
+#endif
 
 position_t LoudsDense::getChildNodeNum(const position_t pos) const {
-  return child_indicator_bitmaps_->rank(pos);
+  return childRank(pos);
+}
+
+position_t LoudsDense::leavesBefore(const level_t level, const position_t pos) const {
+  // pos is a label with a child, so it cancels out of both ranks
+  return labelRank(pos) - childRank(pos) - leaf_offsets_[level];
 }
 
 position_t LoudsDense::getSuffixPos(const position_t pos,
                                     const bool is_prefix_key) const {
   position_t node_num = pos / kNodeFanout;
   position_t suffix_pos =
-      (label_bitmaps_->rank(pos) - child_indicator_bitmaps_->rank(pos) +
+      (labelRank(pos) - childRank(pos) +
           prefixkey_indicator_bits_->rank(node_num) - 1);
-  if (is_prefix_key && label_bitmaps_->readBit(pos) &&
-      !child_indicator_bitmaps_->readBit(pos))
+  if (is_prefix_key && hasLabel(pos) &&
+      !hasChild(pos))
     suffix_pos--;
   return suffix_pos;
 }
 
 position_t LoudsDense::getNextPos(const position_t pos) const {
+#ifdef FST_DENSE_INTERLEAVED
+  return pos + nodes_->distanceToNextLabel(pos);
+#else
   return pos + label_bitmaps_->distanceToNextSetBit(pos);
+#endif
 }
 
 position_t LoudsDense::getPrevPos(const position_t pos,
                                   bool *is_out_of_bound) const {
+#ifdef FST_DENSE_INTERLEAVED
+  position_t distance = nodes_->distanceToPrevLabel(pos);
+#else
   position_t distance = label_bitmaps_->distanceToPrevSetBit(pos);
+#endif
   if (pos <= distance) {
     *is_out_of_bound = true;
     return 0;
@@ -666,7 +874,7 @@ void LoudsDense::Iter::setFlags(const bool is_valid,
 void LoudsDense::Iter::setToFirstLabelInNode(size_t node_number, level_t skipped_ht_levels) {
   skipped_ht_levels_ = skipped_ht_levels;
   position_t pos = node_number * kNodeFanout; // at first position in dense node
-  if (trie_->label_bitmaps_->readBit(pos)) {
+  if (trie_->hasLabel(pos)) {
     pos_in_trie_[0] = pos;
     key_[0] = (label_t) (pos % kNodeFanout);
   } else {
@@ -677,7 +885,7 @@ void LoudsDense::Iter::setToFirstLabelInNode(size_t node_number, level_t skipped
 };
 
 void LoudsDense::Iter::setToFirstLabelInRoot() {
-  if (trie_->label_bitmaps_->readBit(0)) {
+  if (trie_->hasLabel(0)) {
     pos_in_trie_[0] = 0;
     key_[0] = (label_t) 0;
   } else {
@@ -698,7 +906,7 @@ void LoudsDense::Iter::moveToLeftMostKey() {
   assert(key_len_ > 0);
   level_t level = key_len_ - 1;
   position_t pos = pos_in_trie_[level];
-  if (!trie_->child_indicator_bitmaps_->readBit(pos)) { // found leaf node, no subtree
+  if (!trie_->hasChild(pos)) { // found leaf node, no subtree
     rankValuePosition(pos);
     // valid, search complete, moveLeft complete, moveRight complete
     return setFlags(true, true, true, true);
@@ -718,7 +926,7 @@ void LoudsDense::Iter::moveToLeftMostKey() {
     append(pos);
 
     // if trie branch terminates
-    if (!trie_->child_indicator_bitmaps_->readBit(pos)) {
+    if (!trie_->hasChild(pos)) {
       rankValuePosition(pos);
       // valid, search complete, moveLeft complete, moveRight complete
       return setFlags(true, true, true, true);
@@ -733,11 +941,15 @@ void LoudsDense::Iter::moveToLeftMostKey() {
 
 void LoudsDense::Iter::moveToRightMostKey() {
   assert(key_len_ > 0);
+  // rankValuePosition counts the value positions forward only
+  std::fill(value_pos_initialized_.begin(), value_pos_initialized_.end(), false);
   level_t level = key_len_ - 1;
   position_t pos = pos_in_trie_[level];
-  if (!trie_->child_indicator_bitmaps_->readBit(pos))
+  if (!trie_->hasChild(pos)) {
+    rankValuePosition(pos);
     // valid, search complete, moveLeft complete, moveRight complete
     return setFlags(true, true, true, true);
+  }
 
   while (level < trie_->getHeight() - 1) {
     position_t node_num = trie_->getChildNodeNum(pos);
@@ -750,9 +962,11 @@ void LoudsDense::Iter::moveToRightMostKey() {
     append(pos);
 
     // if trie branch terminates
-    if (!trie_->child_indicator_bitmaps_->readBit(pos))
+    if (!trie_->hasChild(pos)) {
+      rankValuePosition(pos);
       // valid, search complete, moveLeft complete, moveRight complete
       return setFlags(true, true, true, true);
+    }
 
     level++;
   }
@@ -769,13 +983,20 @@ uint64_t LoudsDense::Iter::getValue() const {
   return trie_->values_dense_[value_pos_[key_len_ - 1]];
 }
 
+uint64_t LoudsDense::Iter::leavesLeftOfPath() const {
+  uint64_t leaves_left = 0;
+  for (level_t level = 0; level < key_len_; level++)
+    leaves_left += trie_->leavesBefore(level, pos_in_trie_[level]);
+  return leaves_left;
+}
+
 void LoudsDense::Iter::rankValuePosition(size_t pos) {
   if (value_pos_initialized_[key_len_ - 1]) {
     value_pos_[key_len_ - 1]++;
   } else {  // initially rank value position here
     value_pos_initialized_[key_len_ - 1] = true;
-    uint64_t value_index = trie_->label_bitmaps_->rank(pos) -
-        trie_->child_indicator_bitmaps_->rank(pos) -
+    uint64_t value_index = trie_->labelRank(pos) -
+        trie_->childRank(pos) -
         1;  // + prefix but we do not support this so far
     value_pos_[key_len_ - 1] = value_index;
   }
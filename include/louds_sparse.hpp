@@ -1,13 +1,16 @@
 #ifndef LOUDSSPARSE_H_
 #define LOUDSSPARSE_H_
 
+#include <stdexcept>
 #include <string>
 
 #include "config.hpp"
 #include "fst_builder.hpp"
+#include "fst_stats.hpp"
+#include "packed_value_vector.hpp"
 #include "label_vector.hpp"
-#include "rank.hpp"
-#include "select.hpp"
+#include "rank_interleaved.hpp"
+#include "select_inventory.hpp"
 
 namespace fst {
 
@@ -21,6 +24,7 @@ class LoudsSparse {
           start_level_(0),
           start_node_num_(0),
           key_len_(0),
+          dense_leaves_left_(0),
           is_at_terminator_(false) {};
 
     explicit Iter(LoudsSparse *trie)
@@ -28,6 +32,7 @@ class LoudsSparse {
           trie_(trie),
           start_node_num_(0),
           key_len_(0),
+          dense_leaves_left_(0),
           is_at_terminator_(false) {
       start_level_ = trie_->getStartLevel();
       const auto height = trie_->getHeight() - start_level_;
@@ -49,6 +54,11 @@ class LoudsSparse {
 
     void setStartNodeNum(position_t node_num) { start_node_num_ = node_num; };
 
+    bool hasImplicitValues() const { return trie_->hasImplicitValues(); }
+
+    // leaves left of the louds-dense part of the path, see getValue
+    void setDenseLeavesLeft(uint64_t leaves_left) { dense_leaves_left_ = leaves_left; };
+
     void setToFirstLabelInRoot();
 
     void setToLastLabelInRoot();
@@ -81,6 +91,7 @@ class LoudsSparse {
     position_t start_node_num_;  // Passed in by the dense iterator; default = 0
     level_t
         key_len_;  // Start counting from start_level_; does NOT include suffix
+    uint64_t dense_leaves_left_;  // implicit values only
 
     std::vector<label_t> key_;
     std::vector<position_t> pos_in_trie_;
@@ -96,22 +107,54 @@ class LoudsSparse {
  public:
   LoudsSparse() {};
 
-  LoudsSparse(const FSTBuilder *builder, const std::vector<std::string> &keys);
-
-  LoudsSparse(const FSTBuilder *builder, const std::vector<std::string> *keys_ptr = nullptr);
+  // Frees the sparse levels of builder as they are copied, so LoudsDense
+  // must be built from builder first.
+  LoudsSparse(FSTBuilder *builder, KeyFetcher fetch_key = KeyFetcher());
 
   ~LoudsSparse() {}
 
   // point query: trie walk starts at node "in_node_num" instead of root
   // in_node_num is provided by louds-dense's lookupKey function
-  bool lookupKey(const std::string &key, position_t in_node_num,
-                 uint64_t &value) const;
+  // Key is a std::string_view or an IntegerKey.
+  // With implicit values, dense_leaves_left is the number of leaves left of
+  // the louds-dense part of the search path (see LoudsDense::lookupKey).
+  template <typename Key>
+  bool lookupKey(const Key &key, position_t in_node_num,
+                 uint64_t &value, uint64_t dense_leaves_left = 0) const;
 
   bool lookupKeyAtNode(const char *key, uint64_t key_length, position_t in_node_num,
                        uint64_t &value, uint64_t level) const;
 
   bool findNextNodeOrValue(const char keyByte, size_t &node_number) const;
 
+  // Single-level steps of a point lookup, used by FST::lookupKeys to
+  // interleave independent lookups.
+  // prefetchNode prefetches the node index entry or select sample of
+  // node_num; locateNode
+  // returns the position of its first label and prefetches the labels and
+  // child indicator bits that lookupStep reads next.
+  void prefetchNode(position_t node_num) const;
+
+  position_t locateNode(position_t node_num) const;
+
+  // Returns false if label does not exist in the node starting at pos.
+  // Otherwise, pos is set to the child node number, or to the value index
+  // if the branch terminates (is_leaf).
+  bool lookupStep(label_t label, position_t &pos, bool &is_leaf) const;
+
+  // One level of a FixedKeyFST lookup: finds label in node node_num and sets
+  // node_num to the child node number, or to the value index if the branch
+  // terminates (is_leaf). Fixed-length keys store no terminators.
+  bool lookupFixedStep(label_t label, position_t &node_num, bool &is_leaf) const;
+
+  void prefetchValue(position_t value_index) const {
+    values_sparse_.prefetch(value_index);
+  }
+
+  uint64_t getValue(position_t value_index) const {
+    return values_sparse_[value_index];
+  }
+
   bool nodeHasMultipleBranchesOrTerminates(size_t &nodeNumber, size_t level, std::vector<uint8_t> &prefixLabels) const;
 
   void getNode(size_t nodeNumber, std::vector<uint8_t> &labels, std::vector<uint64_t> &values);
@@ -130,11 +173,26 @@ class LoudsSparse {
 
   level_t getStartLevel() const { return start_level_; };
 
+  // values are key ordinals computed from leaf counts, see FSTBuilder::build
+  bool hasImplicitValues() const { return implicit_values_; };
+
+  // number of top sparse levels covered by the node index
+  level_t getNodeIndexLevels() const { return node_index_levels_; };
+
   uint64_t serializedSize() const;
 
   uint64_t getMemoryUsage() const;
 
-  [[nodiscard]] const std::vector<uint64_t> &getValues() const;
+  // Adds the sizes and the level shapes of the sparse levels to stats, whose
+  // levels must be sized already.
+  void collectStats(FSTStats &stats) const;
+
+  // the fetcher is not serialized, deserialized tries need it set again
+  void setKeyFetcher(KeyFetcher fetch_key) { fetch_key_ = std::move(fetch_key); }
+
+  const KeyFetcher &getKeyFetcher() const { return fetch_key_; }
+
+  [[nodiscard]] const PackedValueVector &getValues() const;
 
   void serialize(char *&dst) const {
     memcpy(dst, &height_, sizeof(height_));
@@ -145,10 +203,26 @@ class LoudsSparse {
     dst += sizeof(node_count_dense_);
     memcpy(dst, &child_count_dense_, sizeof(child_count_dense_));
     dst += sizeof(child_count_dense_);
+    memcpy(dst, &node_index_levels_, sizeof(node_index_levels_));
+    dst += sizeof(node_index_levels_);
+    memcpy(dst, &indexed_node_count_, sizeof(indexed_node_count_));
+    dst += sizeof(indexed_node_count_);
+    // an empty node index may have a null data()
+    if (!node_index_.empty()) memcpy(dst, node_index_.data(), node_index_.size() * sizeof(position_t));
+    dst += node_index_.size() * sizeof(position_t);
+    uint32_t implicit_values = implicit_values_;
+    memcpy(dst, &implicit_values, sizeof(implicit_values));
+    dst += sizeof(implicit_values);
+    memcpy(dst, leaf_offsets_.data(), leaf_offsets_.size() * sizeof(position_t));
+    dst += leaf_offsets_.size() * sizeof(position_t);
+    memcpy(dst, label_offsets_.data(), label_offsets_.size() * sizeof(position_t));
+    dst += label_offsets_.size() * sizeof(position_t);
     align(dst);
     labels_->serialize(dst);
     child_indicator_bits_->serialize(dst);
     louds_bits_->serialize(dst);
+    values_sparse_.serialize(dst);
+    subtree_leaves_.serialize(dst);
     align(dst);
   }
 
@@ -165,10 +239,34 @@ class LoudsSparse {
     memcpy(&(louds_sparse->child_count_dense_), src,
            sizeof(louds_sparse->child_count_dense_));
     src += sizeof(louds_sparse->child_count_dense_);
+    memcpy(&(louds_sparse->node_index_levels_), src,
+           sizeof(louds_sparse->node_index_levels_));
+    src += sizeof(louds_sparse->node_index_levels_);
+    memcpy(&(louds_sparse->indexed_node_count_), src,
+           sizeof(louds_sparse->indexed_node_count_));
+    src += sizeof(louds_sparse->indexed_node_count_);
+    if (louds_sparse->indexed_node_count_ > 0) {
+      const position_t *index = reinterpret_cast<const position_t *>(src);
+      louds_sparse->node_index_.assign(index, index + louds_sparse->indexed_node_count_ + 1);
+      src += louds_sparse->node_index_.size() * sizeof(position_t);
+    }
+    uint32_t implicit_values;
+    memcpy(&implicit_values, src, sizeof(implicit_values));
+    src += sizeof(implicit_values);
+    louds_sparse->implicit_values_ = implicit_values;
+    const position_t *leaf_offsets = reinterpret_cast<const position_t *>(src);
+    louds_sparse->leaf_offsets_.assign(leaf_offsets,
+                                       leaf_offsets + louds_sparse->height_ - louds_sparse->start_level_ + 1);
+    src += louds_sparse->leaf_offsets_.size() * sizeof(position_t);
+    const position_t *label_offsets = reinterpret_cast<const position_t *>(src);
+    louds_sparse->label_offsets_.assign(label_offsets, label_offsets + louds_sparse->leaf_offsets_.size());
+    src += louds_sparse->label_offsets_.size() * sizeof(position_t);
     align(src);
     louds_sparse->labels_ = LabelVector::deSerialize(src);
-    louds_sparse->child_indicator_bits_ = BitvectorRank::deSerialize(src);
-    louds_sparse->louds_bits_ = BitvectorSelect::deSerialize(src);
+    louds_sparse->child_indicator_bits_ = BitvectorRankInterleaved::deSerialize(src);
+    louds_sparse->louds_bits_ = BitvectorSelectInventory::deSerialize(src);
+    louds_sparse->values_sparse_ = PackedValueVector::deSerialize(src);
+    louds_sparse->subtree_leaves_ = PackedValueVector::deSerialize(src);
     align(src);
     return louds_sparse;
   }
@@ -184,6 +282,26 @@ class LoudsSparse {
 
   position_t nodeSize(position_t pos) const;
 
+  // same as nodeSize(pos), but answered from the node index if node_num is
+  // indexed; pos must be the first label position of node_num
+  position_t nodeSize(position_t node_num, position_t pos) const;
+
+  // number of leaves at level left of pos; pos must have a child and
+  // child_rank is rank(pos)
+  position_t leavesBefore(level_t level, position_t pos, position_t child_rank) const {
+    return pos + 1 - child_rank - leaf_offsets_[level - start_level_];
+  }
+
+  // Implicit values: ordinal of the leaf at pos on level, given the leaves
+  // left of the path above it. The leaves below level left of pos are read
+  // from subtree_leaves_, so this costs one rank and one packed read, the
+  // same random access an explicit value costs.
+  uint64_t leafOrdinal(level_t level, position_t pos, uint64_t leaves_left) const;
+
+  void initSubtreeLeaves();
+
+  void initNodeIndex(const FSTBuilder *builder);
+
   bool isEndofNode(position_t pos) const;
 
   void moveToLeftInNextSubtrie(position_t pos, position_t node_size,
@@ -196,10 +314,8 @@ class LoudsSparse {
                                 LoudsSparse::Iter &iter) const;
 
  private:
-  static const position_t kRankBasicBlockSize = 512;
-  static const position_t kSelectSampleInterval = 64;
 
-  std::vector<uint64_t> values_sparse_;
+  PackedValueVector values_sparse_;
 
   level_t height_;       // trie height
   level_t start_level_;  // louds-sparse encoding starts at this level
@@ -209,18 +325,32 @@ class LoudsSparse {
   position_t child_count_dense_;
 
   std::unique_ptr<LabelVector> labels_;
-  std::unique_ptr<BitvectorRank> child_indicator_bits_;
-  std::unique_ptr<BitvectorSelect> louds_bits_;
-  // pointer to the original data
-  const std::vector<std::string> *keys_;
+  std::unique_ptr<BitvectorRankInterleaved> child_indicator_bits_;
+  std::unique_ptr<BitvectorSelectInventory> louds_bits_;
+  // number of top sparse levels covered by node_index_
+  level_t node_index_levels_{0};
+  // number of sparse nodes in those levels
+  position_t indexed_node_count_{0};
+  // first label position of each indexed node, plus the first label position
+  // of the next node, so that node i spans [node_index_[i], node_index_[i + 1])
+  std::vector<position_t> node_index_;
+  bool implicit_values_{false};
+  // number of leaves in the sparse levels above each sparse level, plus the
+  // total
+  std::vector<position_t> leaf_offsets_;
+  // the same for labels, i.e. the first label position of each sparse level
+  std::vector<position_t> label_offsets_;
+  // implicit values only: for each sparse level below the first, the leaves
+  // in the subtrees of its first i nodes for every i up to its node count,
+  // then a 0 for the level below the last. The entry of a leaf with child
+  // rank r on level is at r + level - start_level_.
+  PackedValueVector subtree_leaves_;
+  // resolves values to keys for the range seeks
+  KeyFetcher fetch_key_;
 };
 
-const position_t LoudsSparse::kRankBasicBlockSize;
-const position_t LoudsSparse::kSelectSampleInterval;
-
-LoudsSparse::LoudsSparse(const FSTBuilder *builder, const std::vector<std::string> &keys) : LoudsSparse(builder, &keys) {};
 
-LoudsSparse::LoudsSparse(const fst::FSTBuilder *builder, const std::vector<std::string> *keys_ptr) : keys_(keys_ptr) {
+LoudsSparse::LoudsSparse(fst::FSTBuilder *builder, KeyFetcher fetch_key) : fetch_key_(std::move(fetch_key)) {
   height_ = builder->getLabels().size();
   start_level_ = builder->getSparseStartLevel();
 
@@ -235,43 +365,104 @@ LoudsSparse::LoudsSparse(const fst::FSTBuilder *builder, const std::vector<std::
     child_count_dense_ =
         node_count_dense_ + builder->getNodeCounts()[start_level_] - 1;
   }
-  labels_ = std::make_unique<LabelVector>(builder->getLabels(),
-                                          start_level_,
-                                          height_);
-
   std::vector<position_t> num_items_per_level;
   for (level_t level = 0; level < height_; level++) {
     num_items_per_level.push_back(builder->getLabels()[level].size());
   }
-  child_indicator_bits_ = std::make_unique<BitvectorRank>(kRankBasicBlockSize,
-                                                          builder->getChildIndicatorBits(),
-                                                          num_items_per_level,
-                                                          start_level_,
-                                                          height_);
-  louds_bits_ = std::make_unique<BitvectorSelect>(kSelectSampleInterval,
-                                                  builder->getLoudsBits(),
-                                                  num_items_per_level,
-                                                  start_level_,
-                                                  height_);
+  labels_ = std::make_unique<LabelVector>(builder->releaseLabels(),
+                                          start_level_,
+                                          height_);
+  builder->trackFinalMemory(labels_->size());
+
+  child_indicator_bits_ = std::make_unique<BitvectorRankInterleaved>(builder->getChildIndicatorBits(),
+                                                                     num_items_per_level,
+                                                                     start_level_,
+                                                                     height_);
+  builder->trackFinalMemory(child_indicator_bits_->size());
+  builder->releaseChildIndicatorBits();
+  louds_bits_ = std::make_unique<BitvectorSelectInventory>(builder->getLoudsBits(),
+                                                           num_items_per_level,
+                                                           start_level_,
+                                                           height_);
+  builder->trackFinalMemory(louds_bits_->size());
+  builder->releaseLoudsBits();
+  initNodeIndex(builder);
+
+  implicit_values_ = builder->hasImplicitValues();
+  leaf_offsets_.assign(1, 0);
+  for (level_t level = start_level_; level < height_; level++)
+    leaf_offsets_.push_back(leaf_offsets_.back() + builder->getLeafCounts()[level]);
+  label_offsets_.assign(1, 0);
+  for (level_t level = start_level_; level < height_; level++)
+    label_offsets_.push_back(label_offsets_.back() + num_items_per_level[level]);
+
+  // implicit values are derived from leaf counts and need no packed values
+  if (!implicit_values_) values_sparse_ = PackedValueVector(builder->releaseValues(), start_level_, height_);
+  builder->trackFinalMemory(values_sparse_.size());
+  if (implicit_values_) {
+    initSubtreeLeaves();
+    builder->trackFinalMemory(subtree_leaves_.size());
+  }
+}
+
+void LoudsSparse::initNodeIndex(const FSTBuilder *builder) {
+  const std::vector<position_t> &node_counts = builder->getNodeCounts();
+  level_t max_levels = height_ > start_level_ ? height_ - start_level_ : 0;
+  level_t levels = builder->getNodeIndexLevels();
+  if (levels == kNodeIndexAuto) {
+    // grow level by level while the index fits into the budget
+    uint64_t budget = (labels_->size() + child_indicator_bits_->size() + louds_bits_->size()) *
+        kNodeIndexBudgetPercent / 100;
+    uint64_t node_count = 0;
+    levels = 0;
+    while (levels < max_levels) {
+      node_count += node_counts[start_level_ + levels];
+      if ((node_count + 1) * sizeof(position_t) > budget) break;
+      levels++;
+    }
+  }
+  node_index_levels_ = std::min(levels, max_levels);
 
-  values_sparse_ = builder->getSparseValues();
+  indexed_node_count_ = 0;
+  for (level_t level = start_level_; level < start_level_ + node_index_levels_; level++)
+    indexed_node_count_ += node_counts[level];
+  if (indexed_node_count_ == 0) {
+    node_index_levels_ = 0;
+    return;
+  }
+
+  // nodes are numbered in level order, so the indexed nodes are the first
+  // indexed_node_count_ 1's of louds_bits_
+  node_index_.resize(indexed_node_count_ + 1);
+  for (position_t i = 0; i <= indexed_node_count_; i++)
+    node_index_[i] = i < louds_bits_->numOnes() ? louds_bits_->select(i + 1) : louds_bits_->numBits();
 }
 
-bool LoudsSparse::lookupKey(const std::string &key,
+template <typename Key>
+bool LoudsSparse::lookupKey(const Key &key,
                             const position_t in_node_num,
-                            uint64_t &value) const {
+                            uint64_t &value, uint64_t dense_leaves_left) const {
+  uint64_t leaves_left = dense_leaves_left;
   position_t node_num = in_node_num;
   position_t pos = getFirstLabelPos(node_num);
   level_t level = 0;
   for (level = start_level_; level < key.length(); level++) {
-    // child_indicator_bits_->prefetch(pos);
+#ifdef FST_PREFETCH
+    // the child indicator line is only addressed after the label search
+    // otherwise; fetch it in parallel with the labels
+    child_indicator_bits_->prefetch(pos);
+#endif
     if (!labels_->search((label_t) key[level],
                          pos,
-                         nodeSize(pos)))
+                         nodeSize(node_num, pos)))
       return false;
 
     // if trie branch terminates
     if (!child_indicator_bits_->readBit(pos)) {
+      if (implicit_values_) {
+        value = leafOrdinal(level, pos, leaves_left);
+        return true;
+      }
       uint64_t value_pos = pos - child_indicator_bits_->rank(pos);
       value = values_sparse_[value_pos];
       //this check must be performed from the caller
@@ -281,6 +472,7 @@ bool LoudsSparse::lookupKey(const std::string &key,
 
     // move to child
     node_num = getChildNodeNum(pos);
+    if (implicit_values_) leaves_left += leavesBefore(level, pos, node_num - child_count_dense_);
     pos = getFirstLabelPos(node_num);
   }
   return false;
@@ -288,13 +480,16 @@ bool LoudsSparse::lookupKey(const std::string &key,
 
 inline bool LoudsSparse::lookupKeyAtNode(const char *key, uint64_t key_length, position_t in_node_num,
                                          uint64_t &value, uint64_t level) const {
+  // the ordinal needs the leaves left of the path above in_node_num
+  assert(!implicit_values_);
+  if (implicit_values_) throw std::logic_error("lookupKeyAtNode does not support implicit values");
   position_t node_num = in_node_num;
   position_t pos = getFirstLabelPos(node_num);
   for (; level < key_length; level++) {
     // child_indicator_bits_->prefetch(pos);
     if (!labels_->search((label_t) key[level],
                          pos,
-                         nodeSize(pos)))
+                         nodeSize(node_num, pos)))
       return false;
 
     // if trie branch terminates
@@ -313,6 +508,43 @@ inline bool LoudsSparse::lookupKeyAtNode(const char *key, uint64_t key_length, p
   return false;
 }
 
+void LoudsSparse::prefetchNode(const position_t node_num) const {
+  position_t node_id = node_num - node_count_dense_;
+  if (node_id < indexed_node_count_)
+    __builtin_prefetch(node_index_.data() + node_id);
+  else
+    louds_bits_->prefetch(node_id + 1);
+}
+
+position_t LoudsSparse::locateNode(const position_t node_num) const {
+  position_t pos = getFirstLabelPos(node_num);
+  labels_->prefetch(pos);
+  child_indicator_bits_->prefetch(pos);
+  return pos;
+}
+
+bool LoudsSparse::lookupStep(const label_t label, position_t &pos,
+                             bool &is_leaf) const {
+  if (!labels_->search(label, pos, nodeSize(pos))) return false;
+  is_leaf = !child_indicator_bits_->readBit(pos);
+  if (is_leaf)
+    pos = getSuffixPos(pos);
+  else
+    pos = getChildNodeNum(pos);
+  return true;
+}
+
+bool LoudsSparse::lookupFixedStep(const label_t label, position_t &node_num, bool &is_leaf) const {
+  position_t pos = getFirstLabelPos(node_num);
+  if (!labels_->search<false>(label, pos, nodeSize(node_num, pos))) return false;
+  is_leaf = !child_indicator_bits_->readBit(pos);
+  if (is_leaf)
+    node_num = getSuffixPos(pos);
+  else
+    node_num = getChildNodeNum(pos);
+  return true;
+}
+
 // returns true if next node or value is found, false if keyByte is not immanent
 // 1. next nodenumber has been found, return true
 //  - in this case, return next nodenumber and set last to bits to 01
@@ -321,9 +553,11 @@ inline bool LoudsSparse::lookupKeyAtNode(const char *key, uint64_t key_length, p
 // 3. keyByte does not exist in given node
 //  - return false
 bool LoudsSparse::findNextNodeOrValue(const char keyByte, size_t &node_num) const {
+  assert(!implicit_values_);
+  if (implicit_values_) throw std::logic_error("findNextNodeOrValue does not support implicit values");
   position_t pos = getFirstLabelPos(node_num);
 
-  if (!labels_->search((label_t) keyByte, pos, nodeSize(pos))) {
+  if (!labels_->search((label_t) keyByte, pos, nodeSize(node_num, pos))) {
     return false; // key does not exist
   }
   // find next node or value
@@ -338,8 +572,10 @@ bool LoudsSparse::findNextNodeOrValue(const char keyByte, size_t &node_num) cons
 }
 
 void LoudsSparse::getNode(size_t nodeNumber, std::vector<uint8_t> &labels, std::vector<uint64_t> &values) {
+  assert(!implicit_values_);
+  if (implicit_values_) throw std::logic_error("getNode does not support implicit values");
   position_t pos = getFirstLabelPos(nodeNumber);
-  size_t size = nodeSize(pos);
+  size_t size = nodeSize(nodeNumber, pos);
   for (size_t i = pos; i < std::min<size_t>(pos + size, this->child_indicator_bits_->numBits()); i++) {
     labels.emplace_back(labels_->operator[](i));
     if (child_indicator_bits_->readBit(i)) { // there is a child node
@@ -357,7 +593,7 @@ bool LoudsSparse::nodeHasMultipleBranchesOrTerminates(size_t &nodeNumber,
                                                       size_t level,
                                                       std::vector<uint8_t> &prefixLabels) const {
   position_t pos = getFirstLabelPos(nodeNumber);
-  size_t size = nodeSize(pos);
+  size_t size = nodeSize(nodeNumber, pos);
   if (size == 1) {
     if (!child_indicator_bits_->readBit(pos)) {
       return true;
@@ -373,7 +609,7 @@ void LoudsSparse::lookupNodeNumber(const char *key, uint64_t key_length, positio
   position_t pos = getFirstLabelPos(node_num);
 
   for (uint64_t level = start_level_; level < key_length; level++) {
-    bool found_label = labels_->search((label_t) key[level], pos, nodeSize(pos));
+    bool found_label = labels_->search((label_t) key[level], pos, nodeSize(node_num, pos));
     assert(found_label);
     assert(child_indicator_bits_->readBit(pos));
     // move to child
@@ -386,7 +622,7 @@ bool LoudsSparse::lookupNodeNumberOption(const char *key, uint64_t key_length, p
   position_t pos = getFirstLabelPos(node_num);
 
   for (uint64_t level = start_level_; level < key_length; level++) {
-    bool found_label = labels_->search((label_t) key[level], pos, nodeSize(pos));
+    bool found_label = labels_->search((label_t) key[level], pos, nodeSize(node_num, pos));
     if (!found_label || !child_indicator_bits_->readBit(pos)) return false;
     // move to child
     node_num = getChildNodeNum(pos);
@@ -403,7 +639,7 @@ void LoudsSparse::moveToKeyGreaterThan(const std::string &searched_key,
   position_t pos = getFirstLabelPos(node_num);
 
   for (; level < searched_key.length(); level++) {
-    position_t node_size = nodeSize(pos);
+    position_t node_size = nodeSize(node_num, pos);
     // if no exact match
     if (!labels_->search((label_t) searched_key[level], pos, node_size)) {
       // do not return false, but just move to the next bigger key?
@@ -414,9 +650,10 @@ void LoudsSparse::moveToKeyGreaterThan(const std::string &searched_key,
 
     if (!child_indicator_bits_->readBit(pos)) { // trie branch terminates
       iter.rankValuePosition(pos);
-      auto found_key = (*keys_)[iter.getValue()];
+      // without a key fetcher, conservatively stay at the key prefix
+      std::string_view found_key = fetch_key_ ? fetch_key_(iter.getValue()) : std::string_view();
 
-      if (found_key > searched_key) {
+      if (!fetch_key_ || found_key > searched_key) {
         iter.is_valid_ = true;
       } else if (found_key < searched_key) {
         iter++;
@@ -459,7 +696,7 @@ void LoudsSparse::moveToKeyGreaterThan(const std::string &searched_key,
 
   level_t level;
   for (level = start_level_; level < searched_key.length(); level++) {
-    position_t node_size = nodeSize(pos);
+    position_t node_size = nodeSize(node_num, pos);
     // if no exact match
     if (!labels_->search((label_t) searched_key[level], pos, node_size)) {
       // do not return false, but just move to the next bigger key?
@@ -470,9 +707,10 @@ void LoudsSparse::moveToKeyGreaterThan(const std::string &searched_key,
 
     if (!child_indicator_bits_->readBit(pos)) { // / trie branch terminates
       iter.rankValuePosition(pos);
-      auto found_key = (*keys_)[iter.getValue()];
+      // without a key fetcher, conservatively stay at the key prefix
+      std::string_view found_key = fetch_key_ ? fetch_key_(iter.getValue()) : std::string_view();
 
-      if (found_key > searched_key) {
+      if (!fetch_key_ || found_key > searched_key) {
         iter.is_valid_ = true;
       } else if (found_key < searched_key) {
         iter++;
@@ -508,22 +746,58 @@ void LoudsSparse::moveToKeyGreaterThan(const std::string &searched_key,
 }
 
 uint64_t LoudsSparse::serializedSize() const {
-  uint64_t size =
+  // the header is aligned before the bitvectors
+  position_t header_size =
       sizeof(height_) + sizeof(start_level_) + sizeof(node_count_dense_) +
-          sizeof(child_count_dense_) + labels_->serializedSize() +
+          sizeof(child_count_dense_) + sizeof(node_index_levels_) +
+          sizeof(indexed_node_count_) + node_index_.size() * sizeof(position_t) +
+          sizeof(uint32_t) + (leaf_offsets_.size() + label_offsets_.size()) * sizeof(position_t);
+  sizeAlign(header_size);
+  uint64_t size =
+      header_size + labels_->serializedSize() +
           child_indicator_bits_->serializedSize()
-          + louds_bits_->serializedSize();
+          + louds_bits_->serializedSize() + values_sparse_.serializedSize() + subtree_leaves_.serializedSize();
   sizeAlign(size);
   return size;
 }
 
-const std::vector<uint64_t> &LoudsSparse::getValues() const {
+const PackedValueVector &LoudsSparse::getValues() const {
   return values_sparse_;
 }
 
 uint64_t LoudsSparse::getMemoryUsage() const {
   return (sizeof(*this) + labels_->size() + child_indicator_bits_->size() +
-      louds_bits_->size() + values_sparse_.size() * 8);
+      louds_bits_->size() + node_index_.size() * sizeof(position_t) +
+      (leaf_offsets_.size() + label_offsets_.size()) * sizeof(position_t) +
+      values_sparse_.size() + subtree_leaves_.size());
+}
+
+void LoudsSparse::collectStats(FSTStats &stats) const {
+  stats.labels_bytes += labels_->size() - sizeof(LabelVector);
+  stats.child_bits_bytes += child_indicator_bits_->bitsSize();
+  stats.rank_lut_bytes +=
+      child_indicator_bits_->size() - sizeof(BitvectorRankInterleaved) - child_indicator_bits_->bitsSize();
+  stats.louds_bits_bytes += louds_bits_->bitsSize();
+  stats.select_lut_bytes += louds_bits_->inventorySize();
+  stats.sparse_values_bytes += values_sparse_.size() - sizeof(PackedValueVector);
+  stats.sparse_values_bytes += subtree_leaves_.size() - sizeof(PackedValueVector);
+  stats.node_index_bytes += node_index_.size() * sizeof(position_t);
+
+  for (level_t level = start_level_; level < height_; level++) {
+    FSTLevelStats &level_stats = stats.levels[level];
+    position_t begin = label_offsets_[level - start_level_];
+    position_t end = label_offsets_[level - start_level_ + 1];
+    level_stats.items = end - begin;
+    level_stats.leaves = leaf_offsets_[level - start_level_ + 1] - leaf_offsets_[level - start_level_];
+    // a node starts at every set LOUDS bit and ends at the next one
+    position_t node_start = begin;
+    for (position_t pos = begin + 1; pos <= end; pos++) {
+      if (pos < end && !louds_bits_->readBit(pos)) continue;
+      level_stats.nodes++;
+      stats.addNode(pos - node_start);
+      node_start = pos;
+    }
+  }
 }
 
 position_t LoudsSparse::getChildNodeNum(const position_t pos) const {
@@ -531,15 +805,64 @@ position_t LoudsSparse::getChildNodeNum(const position_t pos) const {
 }
 
 position_t LoudsSparse::getFirstLabelPos(const position_t node_num) const {
-  return louds_bits_->select(node_num + 1 - node_count_dense_);
+  position_t node_id = node_num - node_count_dense_;
+  if (node_id < indexed_node_count_) return node_index_[node_id];
+  return louds_bits_->select(node_id + 1);
 }
 
 position_t LoudsSparse::getLastLabelPos(const position_t node_num) const {
-  position_t next_rank = node_num + 2 - node_count_dense_;
+  position_t node_id = node_num - node_count_dense_;
+  if (node_id < indexed_node_count_) return node_index_[node_id + 1] - 1;
+  position_t next_rank = node_id + 2;
   if (next_rank > louds_bits_->numOnes()) return (louds_bits_->numBits() - 1);
   return (louds_bits_->select(next_rank) - 1);
 }
 
+void LoudsSparse::initSubtreeLeaves() {
+  // leaves in the subtree of every sparse node, bottom-up; node ids are
+  // node numbers minus node_count_dense_ and count in level order
+  std::vector<uint64_t> node_leaves(louds_bits_->numOnes(), 0);
+  std::vector<position_t> first_node{0};
+  for (level_t level = start_level_; level < height_; level++) {
+    position_t nodes = 0;
+    for (position_t pos = label_offsets_[level - start_level_]; pos < label_offsets_[level - start_level_ + 1]; pos++)
+      nodes += louds_bits_->readBit(pos);
+    first_node.push_back(first_node.back() + nodes);
+  }
+  for (level_t level = height_; level-- > start_level_;) {
+    position_t node_id = first_node[level - start_level_] - 1;
+    for (position_t pos = label_offsets_[level - start_level_]; pos < label_offsets_[level - start_level_ + 1]; pos++) {
+      if (louds_bits_->readBit(pos)) node_id++;
+      if (child_indicator_bits_->readBit(pos))
+        node_leaves[node_id] += node_leaves[getChildNodeNum(pos) - node_count_dense_];
+      else
+        node_leaves[node_id]++;
+    }
+  }
+
+  std::vector<uint64_t> subtree_leaves;
+  for (level_t level = start_level_ + 1; level < height_; level++) {
+    uint64_t leaves = 0;
+    for (position_t node_id = first_node[level - start_level_]; node_id < first_node[level - start_level_ + 1];
+         node_id++) {
+      subtree_leaves.push_back(leaves);
+      leaves += node_leaves[node_id];
+    }
+    subtree_leaves.push_back(leaves);
+  }
+  subtree_leaves.push_back(0);
+  subtree_leaves_ = PackedValueVector(subtree_leaves);
+}
+
+uint64_t LoudsSparse::leafOrdinal(const level_t level, const position_t pos, const uint64_t leaves_left) const {
+  position_t child_rank = child_indicator_bits_->rank(pos);
+  // the nodes on level + 1 left of pos are the children of rank below
+  // child_rank, and the first entry of that level is at its
+  // level - start_level_ entries from the levels above
+  return leaves_left + (pos - child_rank - leaf_offsets_[level - start_level_]) +
+      subtree_leaves_[child_rank + level - start_level_];
+}
+
 position_t LoudsSparse::getSuffixPos(const position_t pos) const {
   return (pos - child_indicator_bits_->rank(pos));
 }
@@ -549,6 +872,12 @@ position_t LoudsSparse::nodeSize(const position_t pos) const {
   return louds_bits_->distanceToNextSetBit(pos);
 }
 
+position_t LoudsSparse::nodeSize(const position_t node_num, const position_t pos) const {
+  position_t node_id = node_num - node_count_dense_;
+  if (node_id < indexed_node_count_) return node_index_[node_id + 1] - pos;
+  return nodeSize(pos);
+}
+
 bool LoudsSparse::isEndofNode(const position_t pos) const {
   return ((pos == louds_bits_->numBits() - 1) || louds_bits_->readBit(pos + 1));
 }
@@ -688,6 +1017,8 @@ void LoudsSparse::Iter::moveToLeftMostKey() {
 }
 
 void LoudsSparse::Iter::moveToRightMostKey() {
+  // rankValuePosition counts the value positions forward only
+  std::fill(value_pos_initialized_.begin(), value_pos_initialized_.end(), false);
   if (key_len_ == 0) {
     // todo can we remove the following statement since it has no effect?
     trie_->getFirstLabelPos(start_node_num_);
@@ -704,6 +1035,7 @@ void LoudsSparse::Iter::moveToRightMostKey() {
     if ((label == kTerminator) && !trie_->isEndofNode(pos))
       is_at_terminator_ = true;
     is_valid_ = true;
+    rankValuePosition(pos);
     return;
   }
 
@@ -716,6 +1048,7 @@ void LoudsSparse::Iter::moveToRightMostKey() {
       append(label, pos);
       if ((label == kTerminator) && !trie_->isEndofNode(pos))
         is_at_terminator_ = true;
+      rankValuePosition(pos);
       is_valid_ = true;
       return;
     }
@@ -726,6 +1059,14 @@ void LoudsSparse::Iter::moveToRightMostKey() {
 }
 
 uint64_t LoudsSparse::Iter::getValue() const {
+  if (trie_->implicit_values_) {
+    uint64_t leaves_left = dense_leaves_left_;
+    for (level_t i = 0; i + 1 < key_len_; i++) {
+      position_t pos = pos_in_trie_[i];
+      leaves_left += trie_->leavesBefore(start_level_ + i, pos, trie_->child_indicator_bits_->rank(pos));
+    }
+    return trie_->leafOrdinal(start_level_ + key_len_ - 1, pos_in_trie_[key_len_ - 1], leaves_left);
+  }
   return trie_->values_sparse_[value_pos_[key_len_ - 1]];
 }
 
@@ -0,0 +1,182 @@
+#ifndef PACKEDVALUEVECTOR_H_
+#define PACKEDVALUEVECTOR_H_
+
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include "config.hpp"
+
+namespace fst {
+
+// Leaf values stored with a fixed bit width, chosen at build time as the
+// width of the largest value. Value i occupies bits [i * width, (i + 1) * width)
+// of the word array, least significant bit first. A trailing zero word lets
+// read() always combine two words, so extraction has no branch on whether a
+// value straddles a word boundary. After deSerialize the words are read in
+// place from the serialized data instead of being copied.
+//
+// FSTBuilder also fills one vector per trie level with push_back, which
+// widens the vector if a value does not fit.
+class PackedValueVector {
+ public:
+  PackedValueVector() : num_values_(0), width_(1), mask_(1){};
+
+  // empty, for push_back
+  explicit PackedValueVector(const uint32_t width) : num_values_(0) { initWords(width, 0); }
+
+  explicit PackedValueVector(const std::vector<uint64_t> &values) : num_values_(values.size()) {
+    uint64_t max_value = 0;
+    for (uint64_t value : values) max_value |= value;
+    initWords(bitWidth(max_value), num_values_);
+    for (position_t i = 0; i < num_values_; i++) write(i, values[i]);
+  }
+
+  // Packs levels [start_level, end_level) of values_per_level in order, with
+  // the width of their largest value, and frees each level right after it is
+  // copied. Other levels are left as is.
+  PackedValueVector(std::vector<PackedValueVector> &&values_per_level, const level_t start_level,
+                    const level_t end_level)
+      : num_values_(0) {
+    uint64_t max_value = 0;
+    for (level_t level = start_level; level < end_level; level++) {
+      const PackedValueVector &level_values = values_per_level[level];
+      num_values_ += level_values.num_values_;
+      for (position_t i = 0; i < level_values.num_values_; i++) max_value |= level_values.read(i);
+    }
+    initWords(bitWidth(max_value), num_values_);
+    position_t i = 0;
+    for (level_t level = start_level; level < end_level; level++) {
+      const PackedValueVector &level_values = values_per_level[level];
+      for (position_t j = 0; j < level_values.num_values_; j++) write(i++, level_values.read(j));
+      values_per_level[level] = PackedValueVector();
+    }
+  }
+
+  ~PackedValueVector() = default;
+
+  // data_ points into words_, whose buffer a move keeps but a copy does not
+  PackedValueVector(const PackedValueVector &) = delete;
+  PackedValueVector &operator=(const PackedValueVector &) = delete;
+  PackedValueVector(PackedValueVector &&) = default;
+  PackedValueVector &operator=(PackedValueVector &&) = default;
+
+  uint64_t read(const position_t index) const {
+    assert(index < num_values_);
+    uint64_t bit = static_cast<uint64_t>(index) * width_;
+    const word_t *word = data_ + bit / kWordSize;
+    position_t offset = bit % kWordSize;
+    // (word[1] << 1) << (63 - offset) avoids the undefined shift by 64
+    return ((word[0] >> offset) | ((word[1] << 1) << (kWordSize - 1 - offset))) & mask_;
+  }
+
+  uint64_t operator[](const position_t index) const { return read(index); }
+
+  void push_back(const uint64_t value) {
+    if (value > mask_) widen(bitWidth(value));
+    const uint64_t num_words = (static_cast<uint64_t>(num_values_ + 1) * width_ + kWordSize - 1) / kWordSize + 1;
+    if (num_words > num_words_) {
+      words_.resize(num_words, 0);
+      num_words_ = num_words;
+      data_ = words_.data();
+    }
+    write(num_values_++, value);
+  }
+
+  void append(const PackedValueVector &other) {
+    for (position_t i = 0; i < other.num_values_; i++) push_back(other.read(i));
+  }
+
+  // bits needed for value, at least 1
+  static uint32_t bitWidth(const uint64_t value) { return (value == 0) ? 1 : kWordSize - __builtin_clzll(value); }
+
+  void prefetch(const position_t index) const {
+    __builtin_prefetch(data_ + static_cast<uint64_t>(index) * width_ / kWordSize);
+  }
+
+  position_t numValues() const { return num_values_; }
+
+  // bits per value
+  uint32_t width() const { return width_; }
+
+  // in bytes
+  uint64_t size() const { return (sizeof(PackedValueVector) + num_words_ * sizeof(word_t)); }
+
+  // in bytes, including the spare capacity of a vector filled by push_back
+  uint64_t allocatedSize() const { return (sizeof(PackedValueVector) + words_.capacity() * sizeof(word_t)); }
+
+  uint64_t serializedSize() const {
+    // the header is aligned before the words
+    uint64_t size = sizeof(num_values_) + sizeof(width_) + sizeof(num_words_);
+    sizeAlign(size);
+    size += num_words_ * sizeof(word_t);
+    sizeAlign(size);
+    return size;
+  }
+
+  void serialize(char *&dst) const {
+    memcpy(dst, &num_values_, sizeof(num_values_));
+    dst += sizeof(num_values_);
+    memcpy(dst, &width_, sizeof(width_));
+    dst += sizeof(width_);
+    memcpy(dst, &num_words_, sizeof(num_words_));
+    dst += sizeof(num_words_);
+    align(dst);
+    // a default-constructed vector has no words and a null data_
+    if (num_words_ > 0) memcpy(dst, data_, num_words_ * sizeof(word_t));
+    dst += num_words_ * sizeof(word_t);
+    align(dst);
+  }
+
+  static PackedValueVector deSerialize(char *&src) {
+    PackedValueVector values;
+    memcpy(&values.num_values_, src, sizeof(values.num_values_));
+    src += sizeof(values.num_values_);
+    memcpy(&values.width_, src, sizeof(values.width_));
+    src += sizeof(values.width_);
+    values.mask_ = kOneMask >> (kWordSize - values.width_);
+    memcpy(&values.num_words_, src, sizeof(values.num_words_));
+    src += sizeof(values.num_words_);
+    align(src);
+    values.data_ = reinterpret_cast<const word_t *>(src);
+    src += values.num_words_ * sizeof(word_t);
+    align(src);
+    return values;
+  }
+
+ private:
+  void initWords(const uint32_t width, const position_t num_values) {
+    width_ = width;
+    mask_ = kOneMask >> (kWordSize - width_);
+    num_words_ = (static_cast<uint64_t>(num_values) * width_ + kWordSize - 1) / kWordSize + 1;
+    words_.assign(num_words_, 0);
+    data_ = words_.data();
+  }
+
+  void widen(const uint32_t width) {
+    PackedValueVector wider(width);
+    wider.words_.reserve((static_cast<uint64_t>(num_values_) * width + kWordSize - 1) / kWordSize + 1);
+    for (position_t i = 0; i < num_values_; i++) wider.push_back(read(i));
+    *this = std::move(wider);
+  }
+
+  void write(const position_t index, const uint64_t value) {
+    uint64_t bit = static_cast<uint64_t>(index) * width_;
+    word_t *word = words_.data() + bit / kWordSize;
+    position_t offset = bit % kWordSize;
+    word[0] |= value << offset;
+    if (offset + width_ > kWordSize) word[1] |= value >> (kWordSize - offset);
+  }
+
+  position_t num_values_;
+  uint32_t width_;
+  uint64_t mask_;
+  uint64_t num_words_{0};
+  // words_ when built, the serialized words after deSerialize
+  const word_t *data_{nullptr};
+  std::vector<word_t> words_;
+};
+
+}  // namespace fst
+
+#endif  // PACKEDVALUEVECTOR_H_
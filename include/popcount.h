@@ -5,6 +5,9 @@
 #include <sys/types.h>
 #include <cstdint>
 #include <cstdio>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
 
 namespace fst {
 
@@ -147,6 +150,17 @@ inline int select64_popcount_search(uint64_t x, int k) {
   return loc + k;
 }
 
+// Same result as select64_popcount_search. With BMI2, pdep deposits a single
+// bit onto the (popcount - k)-th set bit counted from the least significant
+// end, which is the k-th set bit counted from the most significant end.
+inline int select64_pdep(uint64_t x, int k) {
+#ifdef __BMI2__
+  return __builtin_clzll(_pdep_u64(1ULL << (popcount(x) - k), x));
+#else
+  return select64_popcount_search(x, k);
+#endif
+}
+
 inline int select64(uint64_t x, int k) {
   return select64_popcount_search(x, k);
 }
@@ -0,0 +1,186 @@
+#ifndef PREFILTER_H_
+#define PREFILTER_H_
+
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "config.hpp"
+#include "hash.hpp"
+
+namespace fst {
+
+// Blocked Bloom filter consulted by FST::lookupKey before the trie walk.
+// Every key sets num_probes_ bits inside a single 512-bit block, so a
+// membership test touches one cache line. The block is chosen by one hash
+// of the key, the bits inside the block by a second hash and double hashing
+// as in LevelDB's Bloom filter.
+class BlockedBloomFilter {
+ public:
+  static const position_t kBlockBits = 512;
+  static const position_t kWordsPerBlock = kBlockBits / kWordSize;
+  static const uint32_t kMaxProbes = 16;
+  static const uint32_t kBlockSeed = 0x7a3c9e51;
+  static const uint32_t kProbeSeed = 0xbc9f1d34;
+
+  struct alignas(64) Block {
+    word_t words[kWordsPerBlock];
+  };
+
+  BlockedBloomFilter() : num_blocks_(0), num_probes_(0){};
+
+  BlockedBloomFilter(const std::vector<std::string> &keys, uint32_t bits_per_key);
+
+  // the keys at indices, e.g. the distinct ones of a key set with repeats
+  BlockedBloomFilter(const std::vector<std::string> &keys, const std::vector<uint64_t> &indices,
+                     uint32_t bits_per_key);
+
+  // integer keys are added as their big-endian byte string
+  template <typename Int>
+  BlockedBloomFilter(const std::vector<Int> &keys, uint32_t bits_per_key);
+
+  ~BlockedBloomFilter() = default;
+
+  // blocks_ points into storage_ or into serialized data
+  BlockedBloomFilter(const BlockedBloomFilter &) = delete;
+  BlockedBloomFilter &operator=(const BlockedBloomFilter &) = delete;
+
+  // false means the key is definitely not in the key set
+  bool mayContain(std::string_view key) const { return test(key.data(), key.size()); }
+
+  template <typename Int>
+  bool mayContain(const IntegerKey<Int> &key) const {
+    Int word = toBigEndian(key.word);
+    return test(reinterpret_cast<const char *>(&word), sizeof(Int));
+  }
+
+  position_t numBlocks() const { return num_blocks_; }
+
+  uint32_t numProbes() const { return num_probes_; }
+
+  // in bytes
+  position_t blocksSize() const { return num_blocks_ * sizeof(Block); }
+
+  position_t serializedSize() const {
+    position_t size = sizeof(num_blocks_) + sizeof(num_probes_) + kCacheLinePadSize + blocksSize();
+    sizeAlign(size);
+    return size;
+  }
+
+  position_t size() const { return (sizeof(BlockedBloomFilter) + blocksSize()); }
+
+  void serialize(char *&dst) const {
+    memcpy(dst, &num_blocks_, sizeof(num_blocks_));
+    dst += sizeof(num_blocks_);
+    memcpy(dst, &num_probes_, sizeof(num_probes_));
+    dst += sizeof(num_probes_);
+    align(dst);
+    uint64_t pad = padCacheLineStart(dst);
+    // a default-constructed filter has no blocks and a null blocks_
+    if (num_blocks_ > 0) memcpy(dst, blocks_, blocksSize());
+    dst += blocksSize();
+    padCacheLineEnd(dst, pad, true);
+  }
+
+  static std::unique_ptr<BlockedBloomFilter> deSerialize(char *&src) {
+    auto filter = std::make_unique<BlockedBloomFilter>();
+    memcpy(&(filter->num_blocks_), src, sizeof(filter->num_blocks_));
+    src += sizeof(filter->num_blocks_);
+    memcpy(&(filter->num_probes_), src, sizeof(filter->num_probes_));
+    src += sizeof(filter->num_probes_);
+    align(src);
+    uint64_t pad = skipCacheLineStart(src);
+    filter->blocks_ = reinterpret_cast<Block *>(src);
+    src += filter->blocksSize();
+    padCacheLineEnd(src, pad);
+    return filter;
+  }
+
+ private:
+  position_t blockIndex(const char *key, size_t key_length) const {
+    return (static_cast<uint64_t>(Hash(key, key_length, kBlockSeed)) * num_blocks_) >> 32;
+  }
+
+  // sizes and clears the blocks for num_keys keys
+  void init(uint64_t num_keys, uint32_t bits_per_key);
+
+  void add(const char *key, size_t key_length);
+
+  bool test(const char *key, size_t key_length) const;
+
+  position_t num_blocks_;
+  uint32_t num_probes_;
+  std::vector<Block> storage_;
+  // storage_ when built, the serialized blocks after deSerialize
+  Block *blocks_{nullptr};
+};
+
+const position_t BlockedBloomFilter::kBlockBits;
+const position_t BlockedBloomFilter::kWordsPerBlock;
+const uint32_t BlockedBloomFilter::kMaxProbes;
+const uint32_t BlockedBloomFilter::kBlockSeed;
+const uint32_t BlockedBloomFilter::kProbeSeed;
+
+BlockedBloomFilter::BlockedBloomFilter(const std::vector<std::string> &keys, const uint32_t bits_per_key) {
+  init(keys.size(), bits_per_key);
+  for (const auto &key : keys) add(key.data(), key.size());
+}
+
+BlockedBloomFilter::BlockedBloomFilter(const std::vector<std::string> &keys, const std::vector<uint64_t> &indices,
+                                       const uint32_t bits_per_key) {
+  init(indices.size(), bits_per_key);
+  for (uint64_t index : indices) add(keys[index].data(), keys[index].size());
+}
+
+template <typename Int>
+BlockedBloomFilter::BlockedBloomFilter(const std::vector<Int> &keys, const uint32_t bits_per_key) {
+  init(keys.size(), bits_per_key);
+  for (Int key : keys) {
+    Int word = toBigEndian(key);
+    add(reinterpret_cast<const char *>(&word), sizeof(Int));
+  }
+}
+
+void BlockedBloomFilter::init(const uint64_t num_keys, const uint32_t bits_per_key) {
+  assert(bits_per_key > 0);
+  uint64_t num_bits = num_keys * bits_per_key;
+  num_blocks_ = (num_bits + kBlockBits - 1) / kBlockBits;
+  if (num_blocks_ == 0) num_blocks_ = 1;
+  // k = bits_per_key * ln(2) minimizes the false positive rate
+  num_probes_ = bits_per_key * 69 / 100;
+  if (num_probes_ < 1) num_probes_ = 1;
+  if (num_probes_ > kMaxProbes) num_probes_ = kMaxProbes;
+  storage_.resize(num_blocks_);
+  blocks_ = storage_.data();
+  memset(blocks_, 0, blocksSize());
+}
+
+void BlockedBloomFilter::add(const char *key, const size_t key_length) {
+  word_t *words = blocks_[blockIndex(key, key_length)].words;
+  uint32_t h = Hash(key, key_length, kProbeSeed);
+  const uint32_t delta = (h >> 17) | (h << 15);  // rotate right 17 bits
+  for (uint32_t i = 0; i < num_probes_; i++) {
+    position_t bit = h % kBlockBits;
+    words[bit / kWordSize] |= kMsbMask >> (bit % kWordSize);
+    h += delta;
+  }
+}
+
+bool BlockedBloomFilter::test(const char *key, const size_t key_length) const {
+  const word_t *words = blocks_[blockIndex(key, key_length)].words;
+  uint32_t h = Hash(key, key_length, kProbeSeed);
+  const uint32_t delta = (h >> 17) | (h << 15);
+  for (uint32_t i = 0; i < num_probes_; i++) {
+    position_t bit = h % kBlockBits;
+    if ((words[bit / kWordSize] & (kMsbMask >> (bit % kWordSize))) == 0) return false;
+    h += delta;
+  }
+  return true;
+}
+
+}  // namespace fst
+
+#endif  // PREFILTER_H_
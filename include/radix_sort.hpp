@@ -0,0 +1,180 @@
+#ifndef RADIXSORT_H_
+#define RADIXSORT_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.hpp"
+
+namespace fst {
+
+// Stable MSD radix sort of key indices by the key bytes, as FSTBuilder
+// consumes them: a key sorts before all keys it is a prefix of, and equal
+// keys keep their input order. Every pass distributes a range into 257
+// buckets (key ended, then one per byte value); ranges of at most
+// kSmallRange keys are finished by a comparison sort. With several threads
+// the passes over the large top ranges are split into chunks, and the
+// buckets they produce are then sorted by the threads in parallel.
+class RadixSorter {
+ public:
+  static const uint64_t kSmallRange = 64;
+  static const uint32_t kNumBuckets = kFanout + 1;
+
+  RadixSorter(const std::vector<std::string> &keys, const unsigned num_threads)
+      : keys_(keys), num_threads_(std::max(num_threads, 1u)) {}
+
+  // indices of keys in sorted order
+  std::vector<uint64_t> sort() const;
+
+ private:
+  using Counts = std::array<uint64_t, kNumBuckets>;
+
+  struct Range {
+    uint64_t begin;
+    uint64_t end;
+    level_t depth;
+  };
+
+  uint32_t bucket(const uint64_t index, const level_t depth) const {
+    const std::string &key = keys_[index];
+    return depth < key.size() ? static_cast<label_t>(key[depth]) + 1 : 0;
+  }
+
+  // Distributes order[begin, end) by the byte at depth, skipping bytes all
+  // keys share, and appends the unsorted buckets to ranges.
+  void distribute(std::vector<uint64_t> &order, std::vector<uint64_t> &buffer, Range range,
+                  std::vector<Range> &ranges, bool parallel) const;
+
+  void sortRange(std::vector<uint64_t> &order, std::vector<uint64_t> &buffer, Range range) const;
+
+  const std::vector<std::string> &keys_;
+  const unsigned num_threads_;
+};
+
+const uint64_t RadixSorter::kSmallRange;
+const uint32_t RadixSorter::kNumBuckets;
+
+std::vector<uint64_t> RadixSorter::sort() const {
+  std::vector<uint64_t> order(keys_.size());
+  for (uint64_t i = 0; i < order.size(); i++) order[i] = i;
+  std::vector<uint64_t> buffer(keys_.size());
+
+  // split the top ranges in parallel until there are enough to share
+  std::vector<Range> ranges{Range{0, order.size(), 0}};
+  std::vector<Range> tasks;
+  while (!ranges.empty()) {
+    Range range = ranges.back();
+    ranges.pop_back();
+    if (num_threads_ > 1 && range.end - range.begin > order.size() / (4 * num_threads_) &&
+        range.end - range.begin > kSmallRange)
+      distribute(order, buffer, range, ranges, true);
+    else
+      tasks.push_back(range);
+  }
+
+  // largest first, so that no thread ends up with a big range last
+  std::sort(tasks.begin(), tasks.end(),
+            [](const Range &a, const Range &b) { return a.end - a.begin > b.end - b.begin; });
+  std::atomic<size_t> next_task{0};
+  auto worker = [&] {
+    for (size_t task = next_task++; task < tasks.size(); task = next_task++) sortRange(order, buffer, tasks[task]);
+  };
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < num_threads_; i++) threads.emplace_back(worker);
+  worker();
+  for (auto &thread : threads) thread.join();
+  return order;
+}
+
+void RadixSorter::distribute(std::vector<uint64_t> &order, std::vector<uint64_t> &buffer, Range range,
+                             std::vector<Range> &ranges, const bool parallel) const {
+  const uint64_t size = range.end - range.begin;
+  const unsigned num_chunks = parallel ? num_threads_ : 1;
+  std::vector<Counts> counts(num_chunks);
+  auto chunkBegin = [&](const unsigned chunk) { return range.begin + size * chunk / num_chunks; };
+  auto forEachChunk = [&](auto &&body) {
+    if (num_chunks == 1) return body(0u);
+    std::vector<std::thread> threads;
+    for (unsigned chunk = 0; chunk < num_chunks; chunk++) threads.emplace_back(body, chunk);
+    for (auto &thread : threads) thread.join();
+  };
+
+  // bytes all keys share are skipped without moving the keys. One
+  // sequential pass finds them, as it mostly stops at the first key that
+  // differs at depth: counting them byte by byte would start the chunk
+  // threads once per shared byte
+  const std::string &first = keys_[order[range.begin]];
+  size_t shared = first.size();
+  for (uint64_t i = range.begin + 1; i < range.end && shared > range.depth; i++) {
+    const std::string &key = keys_[order[i]];
+    const size_t limit = std::min(shared, key.size());
+    size_t depth = range.depth;
+    while (depth < limit && key[depth] == first[depth]) depth++;
+    shared = depth;
+  }
+  range.depth = shared;
+
+  forEachChunk([&](const unsigned chunk) {
+    counts[chunk].fill(0);
+    for (uint64_t i = chunkBegin(chunk); i < chunkBegin(chunk + 1); i++) counts[chunk][bucket(order[i], range.depth)]++;
+  });
+  // all keys end at depth, so they are equal and stay in input order
+  uint64_t num_ended = 0;
+  for (const Counts &chunk_counts : counts) num_ended += chunk_counts[0];
+  if (num_ended == size) return;
+
+  // chunk c of bucket b starts after the bucket b keys of the chunks before
+  // it, which keeps the sort stable
+  std::vector<Counts> offsets(num_chunks);
+  std::vector<uint64_t> bucket_begin(kNumBuckets + 1);
+  uint64_t offset = range.begin;
+  for (uint32_t b = 0; b < kNumBuckets; b++) {
+    bucket_begin[b] = offset;
+    for (unsigned chunk = 0; chunk < num_chunks; chunk++) {
+      offsets[chunk][b] = offset;
+      offset += counts[chunk][b];
+    }
+  }
+  bucket_begin[kNumBuckets] = offset;
+  forEachChunk([&](const unsigned chunk) {
+    for (uint64_t i = chunkBegin(chunk); i < chunkBegin(chunk + 1); i++)
+      buffer[offsets[chunk][bucket(order[i], range.depth)]++] = order[i];
+  });
+  forEachChunk([&](const unsigned chunk) {
+    std::copy(buffer.begin() + chunkBegin(chunk), buffer.begin() + chunkBegin(chunk + 1),
+              order.begin() + chunkBegin(chunk));
+  });
+
+  // bucket 0 holds the keys that end at depth, which are equal
+  for (uint32_t b = 1; b < kNumBuckets; b++) {
+    if (bucket_begin[b + 1] - bucket_begin[b] > 1)
+      ranges.push_back(Range{bucket_begin[b], bucket_begin[b + 1], static_cast<level_t>(range.depth + 1)});
+  }
+}
+
+void RadixSorter::sortRange(std::vector<uint64_t> &order, std::vector<uint64_t> &buffer, const Range range) const {
+  std::vector<Range> ranges{range};
+  while (!ranges.empty()) {
+    Range current = ranges.back();
+    ranges.pop_back();
+    if (current.end - current.begin > kSmallRange) {
+      distribute(order, buffer, current, ranges, false);
+      continue;
+    }
+    // the first depth bytes are equal
+    std::stable_sort(order.begin() + current.begin, order.begin() + current.end,
+                     [&](const uint64_t a, const uint64_t b) {
+                       return std::string_view(keys_[a]).substr(current.depth) <
+                           std::string_view(keys_[b]).substr(current.depth);
+                     });
+  }
+}
+
+}  // namespace fst
+
+#endif  // RADIXSORT_H_
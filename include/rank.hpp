@@ -7,6 +7,7 @@
 #include <memory>
 
 #include "bitvector.hpp"
+#include "cpu_dispatch.hpp"
 #include "popcount.h"
 
 namespace fst {
@@ -27,6 +28,7 @@ class BitvectorRank : public Bitvector {
   }
 
   ~BitvectorRank() {
+    if (!owns_memory_) return;
     delete[] bits_;
     delete[] rank_lut_;
   }
@@ -40,7 +42,7 @@ class BitvectorRank : public Bitvector {
     position_t block_id = pos / basic_block_size_;
     position_t offset = pos & (basic_block_size_ - 1);
     return (rank_lut_[block_id] +
-        popcountLinear(bits_, block_id * word_per_basic_block, offset + 1));
+        CpuDispatch::popcountLinear(bits_, block_id * word_per_basic_block, offset + 1));
   }
 
   position_t rankLutSize() const {
@@ -77,6 +79,7 @@ class BitvectorRank : public Bitvector {
 
   static std::unique_ptr<BitvectorRank> deSerialize(char *&src) {
     auto bv_rank = std::make_unique<BitvectorRank>();
+    bv_rank->owns_memory_ = false;
     memcpy(&(bv_rank->num_bits_), src, sizeof(bv_rank->num_bits_));
     src += sizeof(bv_rank->num_bits_);
     memcpy(&(bv_rank->basic_block_size_), src,
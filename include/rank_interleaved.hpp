@@ -0,0 +1,237 @@
+#ifndef RANKINTERLEAVED_H_
+#define RANKINTERLEAVED_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "config.hpp"
+#include "popcount.h"
+
+namespace fst {
+
+// Rank directory interleaved with the bits it counts.
+// Every 512-bit cache line starts with a 16-bit counter followed by 496
+// payload bits. The counter holds the number of 1's in the superblock before
+// the middle of the line (line bit 256); a small top-level table keeps the
+// absolute rank of every superblock of kLinesPerSuperblock lines. rank() thus
+// touches one cache line of the bitvector plus a table entry that stays
+// cached, and counts at most four words by going forward or backward from
+// the middle of the line. Space overhead is 16/512 bits plus 32 bits per
+// superblock, about 3.2% in total.
+class BitvectorRankInterleaved {
+ public:
+  static const position_t kLineBits = 512;
+  static const position_t kWordsPerLine = kLineBits / kWordSize;
+  static const position_t kCounterBits = 16;
+  static const position_t kPayloadBits = kLineBits - kCounterBits;
+  static const position_t kMiddleBit = kLineBits / 2;
+  // keeps superblock-relative counters below 2^16
+  static const position_t kLinesPerSuperblock = 128;
+
+  struct alignas(64) Line {
+    word_t words[kWordsPerLine];
+  };
+
+  BitvectorRankInterleaved() : num_bits_(0), num_lines_(0), lines_(nullptr), superblocks_(nullptr){};
+
+  BitvectorRankInterleaved(const std::vector<std::vector<word_t> > &bitvector_per_level,
+                           const std::vector<position_t> &num_bits_per_level,
+                           const level_t start_level = 0,
+                           level_t end_level = 0 /* non-inclusive */) {
+    if (end_level == 0) end_level = bitvector_per_level.size();
+    num_bits_ = 0;
+    for (level_t level = start_level; level < end_level; level++)
+      num_bits_ += num_bits_per_level[level];
+    num_lines_ = num_bits_ / kPayloadBits + 1;
+    lines_ = new Line[num_lines_];
+    memset(lines_, 0, linesSize());
+    fillPayload(bitvector_per_level, num_bits_per_level, start_level, end_level);
+    superblocks_ = new position_t[numSuperblocks()];
+    initCounters();
+  }
+
+  ~BitvectorRankInterleaved() {
+    if (!owns_memory_) return;
+    delete[] lines_;
+    delete[] superblocks_;
+  }
+
+  position_t numBits() const { return num_bits_; }
+
+  bool readBit(const position_t pos) const {
+    assert(pos < num_bits_);
+    position_t bit = pos % kPayloadBits + kCounterBits;
+    const word_t *words = lines_[pos / kPayloadBits].words;
+    return words[bit / kWordSize] & (kMsbMask >> (bit & (kWordSize - 1)));
+  }
+
+  // Counts the number of 1's in the bitvector up to position pos.
+  // pos is zero-based; count is one-based.
+  // E.g., for bitvector: 100101000, rank(3) = 2
+  position_t rank(const position_t pos) const {
+    assert(pos < num_bits_);
+    position_t line_id = pos / kPayloadBits;
+    position_t bit = pos % kPayloadBits + kCounterBits;
+    const word_t *words = lines_[line_id].words;
+    position_t rank = superblocks_[line_id / kLinesPerSuperblock] + counter(words);
+    position_t word_id = bit / kWordSize;
+    position_t offset = bit & (kWordSize - 1);
+    if (bit >= kMiddleBit) {
+      for (position_t i = kMiddleBit / kWordSize; i < word_id; i++) rank += popcount(words[i]);
+      return rank + popcount(words[word_id] >> (kWordSize - 1 - offset));
+    }
+    for (position_t i = word_id + 1; i < kMiddleBit / kWordSize; i++) rank -= popcount(words[i]);
+    // offset < 63 here unless word_id is the last word before the middle
+    return rank - (offset == kWordSize - 1 ? 0 : popcount(words[word_id] << (offset + 1)));
+  }
+
+  void prefetch(const position_t pos) const {
+    __builtin_prefetch(lines_ + pos / kPayloadBits);
+  }
+
+  // in bytes, the payload bits without counters and superblocks
+  position_t bitsSize() const { return (num_bits_ + kWordSize - 1) / kWordSize * sizeof(word_t); }
+
+  // in bytes
+  position_t linesSize() const { return num_lines_ * sizeof(Line); }
+
+  // in bytes
+  position_t superblocksSize() const { return numSuperblocks() * sizeof(position_t); }
+
+  position_t serializedSize() const {
+    position_t size = sizeof(num_bits_) + sizeof(num_lines_) + kCacheLinePadSize + linesSize() + superblocksSize();
+    sizeAlign(size);
+    return size;
+  }
+
+  position_t size() const {
+    return (sizeof(BitvectorRankInterleaved) + linesSize() + superblocksSize());
+  }
+
+  void serialize(char *&dst) const {
+    memcpy(dst, &num_bits_, sizeof(num_bits_));
+    dst += sizeof(num_bits_);
+    memcpy(dst, &num_lines_, sizeof(num_lines_));
+    dst += sizeof(num_lines_);
+    uint64_t pad = padCacheLineStart(dst);
+    memcpy(dst, lines_, linesSize());
+    dst += linesSize();
+    padCacheLineEnd(dst, pad, true);
+    memcpy(dst, superblocks_, superblocksSize());
+    dst += superblocksSize();
+    align(dst);
+  }
+
+  static std::unique_ptr<BitvectorRankInterleaved> deSerialize(char *&src) {
+    auto bv_rank = std::make_unique<BitvectorRankInterleaved>();
+    memcpy(&(bv_rank->num_bits_), src, sizeof(bv_rank->num_bits_));
+    src += sizeof(bv_rank->num_bits_);
+    memcpy(&(bv_rank->num_lines_), src, sizeof(bv_rank->num_lines_));
+    src += sizeof(bv_rank->num_lines_);
+    uint64_t pad = skipCacheLineStart(src);
+    bv_rank->lines_ = reinterpret_cast<Line *>(src);
+    src += bv_rank->linesSize();
+    padCacheLineEnd(src, pad);
+    bv_rank->superblocks_ = reinterpret_cast<position_t *>(src);
+    src += bv_rank->superblocksSize();
+    align(src);
+    bv_rank->owns_memory_ = false;
+    return bv_rank;
+  }
+
+ private:
+  position_t numSuperblocks() const { return num_lines_ / kLinesPerSuperblock + 1; }
+
+  static position_t counter(const word_t *words) { return words[0] >> (kWordSize - kCounterBits); }
+
+  // number of payload 1's in the line before the middle bit
+  static position_t countFirstHalf(const word_t *words) {
+    position_t count = popcount(words[0] & (~0ULL >> kCounterBits));
+    for (position_t i = 1; i < kMiddleBit / kWordSize; i++) count += popcount(words[i]);
+    return count;
+  }
+
+  static position_t countSecondHalf(const word_t *words) {
+    position_t count = 0;
+    for (position_t i = kMiddleBit / kWordSize; i < kWordsPerLine; i++) count += popcount(words[i]);
+    return count;
+  }
+
+  // appends the top num_bits bits of bits at payload position pos
+  void appendBits(position_t pos, word_t bits, position_t num_bits);
+
+  void fillPayload(const std::vector<std::vector<word_t> > &bitvector_per_level,
+                   const std::vector<position_t> &num_bits_per_level, level_t start_level,
+                   level_t end_level /* non-inclusive */);
+
+  void initCounters();
+
+  position_t num_bits_;
+  position_t num_lines_;
+  Line *lines_;
+  position_t *superblocks_;  // absolute rank before each superblock
+  // false after deSerialize: the arrays point into the serialized data
+  bool owns_memory_{true};
+};
+
+const position_t BitvectorRankInterleaved::kLineBits;
+const position_t BitvectorRankInterleaved::kWordsPerLine;
+const position_t BitvectorRankInterleaved::kCounterBits;
+const position_t BitvectorRankInterleaved::kPayloadBits;
+const position_t BitvectorRankInterleaved::kMiddleBit;
+const position_t BitvectorRankInterleaved::kLinesPerSuperblock;
+
+void BitvectorRankInterleaved::appendBits(position_t pos, word_t bits, position_t num_bits) {
+  while (num_bits > 0) {
+    position_t line_id = pos / kPayloadBits;
+    position_t bit = pos % kPayloadBits + kCounterBits;
+    position_t chunk = std::min(num_bits, kLineBits - bit);
+    word_t chunk_bits = (chunk == kWordSize) ? bits : bits & ~(~0ULL >> chunk);
+    word_t *words = lines_[line_id].words;
+    position_t offset = bit & (kWordSize - 1);
+    words[bit / kWordSize] |= chunk_bits >> offset;
+    if (offset + chunk > kWordSize) words[bit / kWordSize + 1] |= chunk_bits << (kWordSize - offset);
+    bits = (chunk == kWordSize) ? 0 : bits << chunk;
+    pos += chunk;
+    num_bits -= chunk;
+  }
+}
+
+void BitvectorRankInterleaved::fillPayload(const std::vector<std::vector<word_t> > &bitvector_per_level,
+                                           const std::vector<position_t> &num_bits_per_level,
+                                           const level_t start_level, const level_t end_level) {
+  position_t pos = 0;
+  for (level_t level = start_level; level < end_level; level++) {
+    position_t num_bits = num_bits_per_level[level];
+    for (position_t word = 0; word * kWordSize < num_bits; word++) {
+      position_t chunk = std::min<position_t>(kWordSize, num_bits - word * kWordSize);
+      appendBits(pos, bitvector_per_level[level][word], chunk);
+      pos += chunk;
+    }
+  }
+}
+
+void BitvectorRankInterleaved::initCounters() {
+  position_t cumu_rank = 0;
+  position_t superblock_rank = 0;
+  for (position_t line_id = 0; line_id < num_lines_; line_id++) {
+    word_t *words = lines_[line_id].words;
+    if (line_id % kLinesPerSuperblock == 0) {
+      superblocks_[line_id / kLinesPerSuperblock] = cumu_rank;
+      superblock_rank = cumu_rank;
+    }
+    position_t first_half = countFirstHalf(words);
+    word_t relative = cumu_rank - superblock_rank + first_half;
+    assert(relative < (1ULL << kCounterBits));
+    words[0] |= relative << (kWordSize - kCounterBits);
+    cumu_rank += first_half + countSecondHalf(words);
+  }
+  if (num_lines_ % kLinesPerSuperblock == 0) superblocks_[numSuperblocks() - 1] = cumu_rank;
+}
+
+}  // namespace fst
+
+#endif  // RANKINTERLEAVED_H_
@@ -2,6 +2,7 @@
 #define SELECT_H_
 
 #include <cassert>
+#include <memory>
 #include <vector>
 
 #include "bitvector.hpp"
@@ -26,6 +27,7 @@ class BitvectorSelect : public Bitvector {
   }
 
   ~BitvectorSelect() {
+    if (!owns_memory_) return;
     delete[] bits_;
     delete[] select_lut_;
   };
@@ -83,6 +85,11 @@ class BitvectorSelect : public Bitvector {
 
   position_t numOnes() const { return num_ones_; }
 
+  // Prefetches the select sample used to answer select(rank).
+  void prefetch(position_t rank) const {
+    __builtin_prefetch(select_lut_ + (rank / sample_interval_));
+  }
+
   void serialize(char *&dst) const {
     memcpy(dst, &num_bits_, sizeof(num_bits_));
     dst += sizeof(num_bits_);
@@ -99,6 +106,7 @@ class BitvectorSelect : public Bitvector {
 
   static std::unique_ptr<BitvectorSelect> deSerialize(char *&src) {
     auto bv_select = std::make_unique<BitvectorSelect>();
+    bv_select->owns_memory_ = false;
     memcpy(&(bv_select->num_bits_), src, sizeof(bv_select->num_bits_));
     src += sizeof(bv_select->num_bits_);
     memcpy(&(bv_select->sample_interval_), src,
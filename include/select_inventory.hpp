@@ -0,0 +1,250 @@
+#ifndef SELECTINVENTORY_H_
+#define SELECTINVENTORY_H_
+
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "bitvector.hpp"
+#include "config.hpp"
+#include "cpu_dispatch.hpp"
+#include "popcount.h"
+
+namespace fst {
+
+// Select with a two-level inventory, in the spirit of Vigna's simple select.
+// The first level stores the position of every kOnesPerBlock-th 1. The second
+// level depends on the span of the block: if the block is shorter than
+// kMaxDenseSpan bits, 16-bit offsets of every 2^k-th 1 are kept, with k chosen
+// so that consecutive entries lie about kTargetSpan bits apart; otherwise the
+// block is sparse and the positions of all its 1's are stored explicitly.
+// The stride is recomputed from the span at query time, so no per-block
+// metadata is needed besides the start of its second-level entries.
+// A select reads the first-level entry, one second-level entry and usually a
+// single cache line of bits, and finishes with an in-word select64.
+class BitvectorSelectInventory : public Bitvector {
+ public:
+  static const position_t kLogOnesPerBlock = 8;
+  static const position_t kOnesPerBlock = 1 << kLogOnesPerBlock;
+  static const position_t kLogTargetSpan = 8;
+  static const position_t kTargetSpan = 1 << kLogTargetSpan;
+  static const position_t kMaxDenseSpan = 1 << 16;
+
+  struct InventoryEntry {
+    position_t pos;    // position of the first 1 of the block
+    position_t begin;  // index of the block's first entry in subinventory_ or explicit_
+  };
+
+  BitvectorSelectInventory() : num_ones_(0), num_blocks_(0), num_subinventory_(0), num_explicit_(0),
+                               inventory_(nullptr), subinventory_(nullptr),
+                               explicit_(nullptr){};
+
+  BitvectorSelectInventory(const std::vector<std::vector<word_t> > &bitvector_per_level,
+                           const std::vector<position_t> &num_bits_per_level,
+                           const level_t start_level = 0,
+                           const level_t end_level = 0 /* non-inclusive */)
+      : Bitvector(bitvector_per_level, num_bits_per_level, start_level,
+                  end_level) {
+    initInventory();
+  }
+
+  ~BitvectorSelectInventory() {
+    if (!owns_memory_) return;
+    delete[] bits_;
+    delete[] inventory_;
+    delete[] subinventory_;
+    delete[] explicit_;
+  }
+
+  // Returns the postion of the rank-th 1 bit.
+  // posistion is zero-based; rank is one-based.
+  // E.g., for bitvector: 100101000, select(3) = 5
+  position_t select(position_t rank) const {
+    assert(rank > 0);
+    assert(rank <= num_ones_);
+    position_t block = (rank - 1) / kOnesPerBlock;
+    position_t rank_in_block = (rank - 1) % kOnesPerBlock;
+    position_t block_pos = inventory_[block].pos;
+    position_t span = inventory_[block + 1].pos - block_pos;
+    if (span >= kMaxDenseSpan) return explicit_[inventory_[block].begin + rank_in_block];
+
+    position_t log_stride = logStride(span);
+    position_t entry = rank_in_block >> log_stride;
+    position_t pos = block_pos + subinventory_[inventory_[block].begin + entry];
+    position_t rank_left = rank_in_block - (entry << log_stride) + 1;
+
+    position_t word_id = pos / kWordSize;
+    word_t word = bits_[word_id] & (~0ULL >> (pos & (kWordSize - 1)));
+    position_t ones_count_in_word = popcount(word);
+    while (ones_count_in_word < rank_left) {
+      rank_left -= ones_count_in_word;
+      word = bits_[++word_id];
+      ones_count_in_word = popcount(word);
+    }
+    return (word_id * kWordSize + CpuDispatch::select64(word, rank_left));
+  }
+
+  position_t numOnes() const { return num_ones_; }
+
+  // Prefetches the first-level entry used to answer select(rank).
+  void prefetch(position_t rank) const {
+    __builtin_prefetch(inventory_ + (rank - 1) / kOnesPerBlock);
+  }
+
+  // in bytes
+  position_t inventorySize() const {
+    return ((num_blocks_ + 1) * sizeof(InventoryEntry) + num_subinventory_ * sizeof(uint16_t) + num_explicit_ * sizeof(position_t));
+  }
+
+  position_t serializedSize() const {
+    // the header is aligned before the bits
+    position_t size = sizeof(num_bits_) + sizeof(num_ones_) + sizeof(num_blocks_) +
+                      sizeof(num_subinventory_) + sizeof(num_explicit_);
+    sizeAlign(size);
+    size += bitsSize() + inventorySize();
+    sizeAlign(size);
+    return size;
+  }
+
+  position_t size() const override {
+    return (sizeof(BitvectorSelectInventory) + bitsSize() + inventorySize());
+  }
+
+  void serialize(char *&dst) const {
+    memcpy(dst, &num_bits_, sizeof(num_bits_));
+    dst += sizeof(num_bits_);
+    memcpy(dst, &num_ones_, sizeof(num_ones_));
+    dst += sizeof(num_ones_);
+    memcpy(dst, &num_blocks_, sizeof(num_blocks_));
+    dst += sizeof(num_blocks_);
+    memcpy(dst, &num_subinventory_, sizeof(num_subinventory_));
+    dst += sizeof(num_subinventory_);
+    memcpy(dst, &num_explicit_, sizeof(num_explicit_));
+    dst += sizeof(num_explicit_);
+    align(dst);
+    memcpy(dst, bits_, bitsSize());
+    dst += bitsSize();
+    memcpy(dst, inventory_, (num_blocks_ + 1) * sizeof(InventoryEntry));
+    dst += (num_blocks_ + 1) * sizeof(InventoryEntry);
+    memcpy(dst, explicit_, num_explicit_ * sizeof(position_t));
+    dst += num_explicit_ * sizeof(position_t);
+    memcpy(dst, subinventory_, num_subinventory_ * sizeof(uint16_t));
+    dst += num_subinventory_ * sizeof(uint16_t);
+    align(dst);
+  }
+
+  static std::unique_ptr<BitvectorSelectInventory> deSerialize(char *&src) {
+    auto bv_select = std::make_unique<BitvectorSelectInventory>();
+    bv_select->owns_memory_ = false;
+    memcpy(&(bv_select->num_bits_), src, sizeof(bv_select->num_bits_));
+    src += sizeof(bv_select->num_bits_);
+    memcpy(&(bv_select->num_ones_), src, sizeof(bv_select->num_ones_));
+    src += sizeof(bv_select->num_ones_);
+    memcpy(&(bv_select->num_blocks_), src, sizeof(bv_select->num_blocks_));
+    src += sizeof(bv_select->num_blocks_);
+    memcpy(&(bv_select->num_subinventory_), src, sizeof(bv_select->num_subinventory_));
+    src += sizeof(bv_select->num_subinventory_);
+    memcpy(&(bv_select->num_explicit_), src, sizeof(bv_select->num_explicit_));
+    src += sizeof(bv_select->num_explicit_);
+    align(src);
+    bv_select->bits_ = reinterpret_cast<word_t *>(src);
+    src += bv_select->bitsSize();
+    bv_select->inventory_ = reinterpret_cast<InventoryEntry *>(src);
+    src += (bv_select->num_blocks_ + 1) * sizeof(InventoryEntry);
+    bv_select->explicit_ = reinterpret_cast<position_t *>(src);
+    src += bv_select->num_explicit_ * sizeof(position_t);
+    bv_select->subinventory_ = reinterpret_cast<uint16_t *>(src);
+    src += bv_select->num_subinventory_ * sizeof(uint16_t);
+    align(src);
+    return bv_select;
+  }
+
+ private:
+  // log2 of the number of 1's between two second-level entries of a dense
+  // block: floor(log2(kOnesPerBlock * kTargetSpan / span)), computed as
+  // kLogOnesPerBlock + kLogTargetSpan - ceil(log2(span)) and clamped to
+  // kLogOnesPerBlock
+  static position_t logStride(const position_t span) {
+    if (span <= kTargetSpan) return kLogOnesPerBlock;
+    position_t log_stride = __builtin_clz(span - 1) + kLogOnesPerBlock + kLogTargetSpan - 32;
+    return log_stride > kLogOnesPerBlock ? kLogOnesPerBlock : log_stride;
+  }
+
+  void appendBlock(const std::vector<position_t> &block, position_t end, std::vector<InventoryEntry> &inventory,
+                   std::vector<uint16_t> &subinventory, std::vector<position_t> &explicit_positions);
+
+  void initInventory();
+
+  position_t num_ones_;
+  position_t num_blocks_;
+  position_t num_subinventory_;
+  position_t num_explicit_;
+  InventoryEntry *inventory_;  // one per block, plus a sentinel holding num_bits_
+  uint16_t *subinventory_;     // dense blocks: offsets from the block start
+  position_t *explicit_;       // sparse blocks: absolute positions of all 1's
+};
+
+const position_t BitvectorSelectInventory::kLogOnesPerBlock;
+const position_t BitvectorSelectInventory::kOnesPerBlock;
+const position_t BitvectorSelectInventory::kLogTargetSpan;
+const position_t BitvectorSelectInventory::kTargetSpan;
+const position_t BitvectorSelectInventory::kMaxDenseSpan;
+
+void BitvectorSelectInventory::appendBlock(const std::vector<position_t> &block, const position_t end,
+                                           std::vector<InventoryEntry> &inventory,
+                                           std::vector<uint16_t> &subinventory,
+                                           std::vector<position_t> &explicit_positions) {
+  position_t span = end - block[0];
+  if (span >= kMaxDenseSpan) {
+    inventory.push_back({block[0], static_cast<position_t>(explicit_positions.size())});
+    explicit_positions.insert(explicit_positions.end(), block.begin(), block.end());
+    return;
+  }
+  inventory.push_back({block[0], static_cast<position_t>(subinventory.size())});
+  position_t stride = 1 << logStride(span);
+  for (position_t i = 0; i < block.size(); i += stride)
+    subinventory.push_back(static_cast<uint16_t>(block[i] - block[0]));
+}
+
+void BitvectorSelectInventory::initInventory() {
+  std::vector<InventoryEntry> inventory;
+  std::vector<uint16_t> subinventory;
+  std::vector<position_t> explicit_positions;
+
+  std::vector<position_t> block;
+  block.reserve(kOnesPerBlock);
+  num_ones_ = 0;
+  for (position_t word_id = 0; word_id < numWords(); word_id++) {
+    word_t word = bits_[word_id];
+    while (word != 0) {
+      position_t pos = word_id * kWordSize + __builtin_clzll(word);
+      word &= ~(kMsbMask >> __builtin_clzll(word));
+      if (block.size() == kOnesPerBlock) {
+        appendBlock(block, pos, inventory, subinventory, explicit_positions);
+        block.clear();
+      }
+      block.push_back(pos);
+      num_ones_++;
+    }
+  }
+  if (!block.empty())
+    appendBlock(block, num_bits_, inventory, subinventory, explicit_positions);
+  num_blocks_ = inventory.size();
+  inventory.push_back({num_bits_, 0});
+  num_subinventory_ = subinventory.size();
+  num_explicit_ = explicit_positions.size();
+  inventory_ = new InventoryEntry[num_blocks_ + 1];
+  memcpy(inventory_, inventory.data(), (num_blocks_ + 1) * sizeof(InventoryEntry));
+  // data() of an empty vector may be null, which memcpy does not allow
+  subinventory_ = new uint16_t[num_subinventory_];
+  if (num_subinventory_ > 0)
+    memcpy(subinventory_, subinventory.data(), num_subinventory_ * sizeof(uint16_t));
+  explicit_ = new position_t[num_explicit_];
+  if (num_explicit_ > 0)
+    memcpy(explicit_, explicit_positions.data(), num_explicit_ * sizeof(position_t));
+}
+
+}  // namespace fst
+
+#endif  // SELECTINVENTORY_H_
@@ -10,12 +10,25 @@ function(add_unit_test file_name name)
             WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR})
 endfunction()
 
+# Builds file_name a second time with the given preprocessor definition.
+function(add_unit_test_variant file_name name definition)
+    add_unit_test(${file_name} ${name})
+    target_compile_definitions(${name} PRIVATE ${definition})
+endfunction()
+
 # ---------------------------------------------------------------------------
 # Add Each Test as Separate Executable
 # ---------------------------------------------------------------------------
 add_unit_test(test/test_fst_example test_example)
 add_unit_test(test/test_fst_example_words test_example_words)
 add_unit_test(test/test_fst_ints test_int32)
+add_unit_test(test/test_cpu_dispatch test_cpu_dispatch)
+add_unit_test(test/test_bitvectors test_bitvectors)
+add_unit_test_variant(test/test_fst_example test_example_dense_interleaved FST_DENSE_INTERLEAVED)
+add_unit_test_variant(test/test_fst_example_words test_example_words_dense_interleaved FST_DENSE_INTERLEAVED)
+add_unit_test_variant(test/test_fst_example_words test_example_words_prefetch FST_PREFETCH)
+add_unit_test_variant(test/test_fst_example_words test_example_words_wide_positions FST_WIDE_POSITIONS)
+add_unit_test_variant(test/test_bitvectors test_bitvectors_wide_positions FST_WIDE_POSITIONS)
 
 
 # ---------------------------------------------------------------------------
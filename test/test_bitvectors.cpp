@@ -0,0 +1,161 @@
+#include "gtest/gtest.h"
+#include <memory>
+#include <random>
+#include <vector>
+#include "config.hpp"
+#include "rank_interleaved.hpp"
+#include "select_inventory.hpp"
+
+namespace fst {
+
+namespace surftest {
+
+// several rank superblocks and select blocks
+static const position_t kNumBits = 3000000;
+// level sizes that are no multiple of the word size, so that the levels are
+// concatenated at odd offsets
+static const position_t kLevelBits[] = {1000003, 999999, 999998};
+// one 1 in this many bits makes a block of kOnesPerBlock 1's span more than
+// kMaxDenseSpan bits
+static const position_t kSparseGap = 400;
+
+class BitvectorTest : public ::testing::Test {
+ public:
+  // Splits bits into levels the way FSTBuilder hands them over: most
+  // significant bit first.
+  void setBits(const std::vector<bool> &bits) {
+    bits_ = bits;
+    bits_per_level_.clear();
+    num_bits_per_level_.clear();
+    position_t begin = 0;
+    for (position_t level_bits : kLevelBits) {
+      std::vector<word_t> words((level_bits + kWordSize - 1) / kWordSize, 0);
+      for (position_t i = 0; i < level_bits; i++) {
+        if (bits[begin + i]) words[i / kWordSize] |= kMsbMask >> (i % kWordSize);
+      }
+      bits_per_level_.push_back(words);
+      num_bits_per_level_.push_back(level_bits);
+      begin += level_bits;
+    }
+    ASSERT_EQ(kNumBits, begin);
+    ASSERT_EQ(kNumBits, bits_.size());
+    ranks_.clear();
+    ones_.clear();
+    position_t rank = 0;
+    for (position_t pos = 0; pos < kNumBits; pos++) {
+      if (bits_[pos]) {
+        rank++;
+        ones_.push_back(pos);
+      }
+      ranks_.push_back(rank);
+    }
+  }
+
+  // 1's with the given probability in [begin, end)
+  static void fillRandom(std::vector<bool> &bits, const position_t begin, const position_t end, const double density,
+                         std::mt19937_64 &rng) {
+    std::bernoulli_distribution one(density);
+    for (position_t pos = begin; pos < end; pos++) bits[pos] = one(rng);
+  }
+
+  // whether some select block is answered from explicit positions
+  bool hasSparseBlock() const {
+    const position_t ones_per_block = BitvectorSelectInventory::kOnesPerBlock;
+    for (position_t first = 0; first < ones_.size(); first += ones_per_block) {
+      position_t end = first + ones_per_block < ones_.size() ? ones_[first + ones_per_block] : kNumBits;
+      if (end - ones_[first] >= BitvectorSelectInventory::kMaxDenseSpan) return true;
+    }
+    return false;
+  }
+
+  void checkRank(const BitvectorRankInterleaved &bv) const {
+    ASSERT_EQ(kNumBits, bv.numBits());
+    for (position_t pos = 0; pos < kNumBits; pos++) {
+      ASSERT_EQ(bits_[pos], bv.readBit(pos)) << "pos " << pos;
+      ASSERT_EQ(ranks_[pos], bv.rank(pos)) << "pos " << pos;
+    }
+  }
+
+  void checkSelect(const BitvectorSelectInventory &bv) const {
+    ASSERT_EQ(kNumBits, bv.numBits());
+    ASSERT_EQ(ones_.size(), bv.numOnes());
+    for (position_t rank = 1; rank <= ones_.size(); rank++) ASSERT_EQ(ones_[rank - 1], bv.select(rank)) << "rank " << rank;
+  }
+
+  // Builds both bitvectors, checks them against the naive rank and select,
+  // and checks them again after a serialization round trip.
+  void checkAll() {
+    // the rank directory is crossed at superblock boundaries
+    ASSERT_GT(kNumBits, 2 * BitvectorRankInterleaved::kLinesPerSuperblock * BitvectorRankInterleaved::kPayloadBits);
+
+    BitvectorRankInterleaved rank_bv(bits_per_level_, num_bits_per_level_);
+    checkRank(rank_bv);
+    std::vector<uint64_t> rank_data(rank_bv.serializedSize() / sizeof(uint64_t) + 1, 0);
+    char *dst = reinterpret_cast<char *>(rank_data.data());
+    rank_bv.serialize(dst);
+    ASSERT_EQ(rank_bv.serializedSize(), dst - reinterpret_cast<char *>(rank_data.data()));
+    char *src = reinterpret_cast<char *>(rank_data.data());
+    std::unique_ptr<BitvectorRankInterleaved> rank_copy = BitvectorRankInterleaved::deSerialize(src);
+    ASSERT_EQ(dst, src);
+    checkRank(*rank_copy);
+
+    BitvectorSelectInventory select_bv(bits_per_level_, num_bits_per_level_);
+    checkSelect(select_bv);
+    std::vector<uint64_t> select_data(select_bv.serializedSize() / sizeof(uint64_t) + 1, 0);
+    dst = reinterpret_cast<char *>(select_data.data());
+    select_bv.serialize(dst);
+    ASSERT_EQ(select_bv.serializedSize(), dst - reinterpret_cast<char *>(select_data.data()));
+    src = reinterpret_cast<char *>(select_data.data());
+    std::unique_ptr<BitvectorSelectInventory> select_copy = BitvectorSelectInventory::deSerialize(src);
+    ASSERT_EQ(dst, src);
+    checkSelect(*select_copy);
+  }
+
+  std::vector<bool> bits_;
+  std::vector<std::vector<word_t> > bits_per_level_;
+  std::vector<position_t> num_bits_per_level_;
+  // naive rank of every position and positions of all 1's
+  std::vector<position_t> ranks_;
+  std::vector<position_t> ones_;
+};
+
+TEST_F (BitvectorTest, Random) {
+  std::mt19937_64 rng(1);
+  std::vector<bool> bits(kNumBits);
+  fillRandom(bits, 0, kNumBits, 0.5, rng);
+  setBits(bits);
+  ASSERT_FALSE(hasSparseBlock());
+  checkAll();
+}
+
+TEST_F (BitvectorTest, Sparse) {
+  std::mt19937_64 rng(2);
+  std::vector<bool> bits(kNumBits);
+  fillRandom(bits, 0, kNumBits, 1.0 / kSparseGap, rng);
+  setBits(bits);
+  ASSERT_TRUE(hasSparseBlock());
+  checkAll();
+}
+
+TEST_F (BitvectorTest, Mixed) {
+  // dense, sparse, empty and full stretches, so that blocks of both kinds
+  // follow each other and some straddle a change of density
+  std::mt19937_64 rng(3);
+  std::vector<bool> bits(kNumBits);
+  const position_t kStretch = 150001;
+  const double kDensities[] = {0.5, 1.0 / kSparseGap, 0.0, 1.0, 0.05};
+  for (position_t begin = 0, i = 0; begin < kNumBits; begin += kStretch, i++)
+    fillRandom(bits, begin, std::min(begin + kStretch, kNumBits), kDensities[i % 5], rng);
+  setBits(bits);
+  ASSERT_TRUE(hasSparseBlock());
+  checkAll();
+}
+
+} // namespace surftest
+
+} // namespace fst
+
+int main(int argc, char *argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,167 @@
+#include "gtest/gtest.h"
+#include <random>
+#include <string>
+#include <vector>
+#include "config.hpp"
+#include "cpu_dispatch.hpp"
+
+namespace fst {
+
+namespace surftest {
+
+// search lengths around the 16, 32 and 64-byte vector widths
+static const position_t kSearchLengths[] = {1, 2, 15, 16, 17, 31, 32, 33, 47, 63, 64, 65, 127, 128, 129, 200, 256};
+static const int kNumWords = 1000;
+
+// Restores the kernels of the CPU we run on when a test ends.
+struct DetectedKernels {
+  ~DetectedKernels() { CpuDispatch::bind(CpuDispatch::detected()); }
+};
+
+class CpuDispatchTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    std::mt19937_64 rng(7);
+    for (int i = 0; i < kNumWords; i++) {
+      // sparse and dense words as well as uniform ones
+      uint64_t word = rng();
+      if (i % 3 == 1) word &= rng() & rng();
+      if (i % 3 == 2) word |= rng() | rng();
+      words.push_back(word);
+    }
+    words.push_back(~0ULL);
+    words.push_back(1);
+    words.push_back(1ULL << 63);
+
+    // few distinct labels, so that both hits and misses are common, then
+    // slowly rising labels like those of a sorted node, so that the first
+    // greater label is often just past the end of the search
+    for (int i = 0; i < 4096; i++) labels.push_back(i % 5 == 0 ? kTerminator : 'a' + rng() % 32);
+    for (int i = 0; i < 4096; i++) labels.push_back(i / 3 % (kMaxLabel + 1));
+    labels.resize(labels.size() + CpuDispatch::kLabelPadding, 0);
+  }
+
+  // Every feature set the CPU supports, from none to all of them.
+  static std::vector<CpuDispatch::Features> supportedFeatureSets() {
+    const CpuDispatch::Features &detected = CpuDispatch::detected();
+    std::vector<CpuDispatch::Features> feature_sets;
+    for (unsigned mask = 0; mask < 16; mask++) {
+      CpuDispatch::Features features{(mask & 1) != 0, (mask & 2) != 0, (mask & 4) != 0, (mask & 8) != 0};
+      if ((features.bmi2 && !detected.bmi2) || (features.avx2 && !detected.avx2) ||
+          (features.avx512bw && !detected.avx512bw) || (features.avx512vpopcntdq && !detected.avx512vpopcntdq))
+        continue;
+      feature_sets.push_back(features);
+    }
+    return feature_sets;
+  }
+
+  // k-th set bit counted from the most significant end, as a bit index
+  // from that end
+  static int referenceSelect64(const uint64_t x, const int k) {
+    int count = 0;
+    for (int i = 0; i < 64; i++) {
+      count += (x >> (63 - i)) & 1;
+      if (count == k) return i;
+    }
+    return -1;
+  }
+
+  // set bits among the first nbits bits from word x on, most significant
+  // bit first
+  static uint64_t referencePopcountLinear(const uint64_t *bits, const uint64_t x, const uint64_t nbits) {
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < nbits; i++) count += (bits[x + i / 64] >> (63 - i % 64)) & 1;
+    return count;
+  }
+
+  template <typename Select64>
+  void checkSelect64(Select64 select) const {
+    for (uint64_t word : words) {
+      for (int k = 1; k <= __builtin_popcountll(word); k++) ASSERT_EQ(referenceSelect64(word, k), select(word, k));
+    }
+  }
+
+  template <typename PopcountLinear>
+  void checkPopcountLinear(PopcountLinear popcount_linear) const {
+    for (uint64_t x : {0, 1, 7, 100}) {
+      for (uint64_t nbits = 0; nbits <= 64 * 20; nbits++)
+        ASSERT_EQ(referencePopcountLinear(words.data(), x, nbits), popcount_linear(words.data(), x, nbits));
+    }
+  }
+
+  // greater selects labelSearchGreaterThan, which finds the first label
+  // greater than target
+  template <typename LabelSearch>
+  void checkLabelSearch(LabelSearch search, const bool greater, const position_t max_length = 256) const {
+    for (position_t length : kSearchLengths) {
+      if (length > max_length) continue;
+      for (position_t begin = 0; begin + length + CpuDispatch::kLabelPadding <= labels.size(); begin += 61) {
+        for (unsigned target = 0; target <= kMaxLabel; target++) {
+          position_t expected = begin;
+          while (expected < begin + length &&
+                 !(greater ? labels[expected] > target : labels[expected] == target))
+            expected++;
+          position_t pos = begin;
+          bool found = search(labels.data(), static_cast<label_t>(target), pos, length);
+          ASSERT_EQ(expected < begin + length, found) << "length " << length << " target " << target;
+          if (found) {
+            ASSERT_EQ(expected, pos) << "length " << length << " target " << target;
+          } else {
+            ASSERT_EQ(begin, pos);
+          }
+        }
+      }
+    }
+  }
+
+  static const unsigned kMaxLabel = 255;
+
+  std::vector<uint64_t> words;
+  std::vector<label_t> labels;
+};
+
+TEST_F (CpuDispatchTest, ScalarKernels) {
+  checkSelect64(CpuDispatch::select64Scalar);
+  checkPopcountLinear(CpuDispatch::popcountLinearScalar);
+  checkLabelSearch(CpuDispatch::labelSearchSse2, false);
+  checkLabelSearch(CpuDispatch::labelSearchGreaterThanSse2, true);
+  checkLabelSearch(CpuDispatch::labelSearch16, false, 16);
+  checkLabelSearch(CpuDispatch::labelSearchGreaterThan16, true, 16);
+}
+
+TEST_F (CpuDispatchTest, VectorKernels) {
+  const CpuDispatch::Features &detected = CpuDispatch::detected();
+  if (detected.bmi2) checkSelect64(CpuDispatch::select64Bmi2);
+  if (detected.avx512vpopcntdq) checkPopcountLinear(CpuDispatch::popcountLinearAvx512);
+  if (detected.avx2) {
+    checkLabelSearch(CpuDispatch::labelSearchAvx2, false);
+    checkLabelSearch(CpuDispatch::labelSearchGreaterThanAvx2, true);
+  }
+  if (detected.avx512bw) {
+    checkLabelSearch(CpuDispatch::labelSearchAvx512, false);
+    checkLabelSearch(CpuDispatch::labelSearchGreaterThanAvx512, true);
+  }
+}
+
+TEST_F (CpuDispatchTest, BoundFeatureSets) {
+  // the dispatched entry points run whatever bind() chose for each set
+  DetectedKernels restore;
+  for (const CpuDispatch::Features &features : supportedFeatureSets()) {
+    SCOPED_TRACE(::testing::Message() << "bmi2 " << features.bmi2 << " avx2 " << features.avx2 << " avx512bw "
+                                      << features.avx512bw << " avx512vpopcntdq " << features.avx512vpopcntdq);
+    CpuDispatch::bind(features);
+    checkSelect64(CpuDispatch::select64);
+    checkPopcountLinear(CpuDispatch::popcountLinear);
+    checkLabelSearch(CpuDispatch::labelSearch, false);
+    checkLabelSearch(CpuDispatch::labelSearchGreaterThan, true);
+  }
+}
+
+} // namespace surftest
+
+} // namespace fst
+
+int main(int argc, char *argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
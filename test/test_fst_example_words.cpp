@@ -1,10 +1,15 @@
 #include "gtest/gtest.h"
+#include <algorithm>
+#include <map>
+#include <random>
 #include <string>
 #include <vector>
 #include "config.hpp"
 #include "fst.hpp"
+#include "test_util.hpp"
 #include <chrono>
 #include <fstream>
+#include <memory_resource>
 
 namespace fst {
 
@@ -111,6 +116,590 @@ TEST_F (SuRFExampleWords, IteratorTest1) {
   size_t surf_mib = surf->getMemoryUsage() / (1024 * 1024);
   std::cout << surf_mib << " MiB" << std::endl;
 }
+TEST_F (SuRFExampleWords, SparseOnlyIteratorTest) {
+  // without dense levels the iterators start and end in LOUDS-Sparse; the
+  // hybrid trie is iterated the same way for comparison
+  for (bool include_dense : {false, true}) {
+    FST *surf = new FST(keys, values_uint64, include_dense, 16);
+    size_t i = 0;
+    for (auto iter = surf->moveToFirst(); iter.isValid(); iter++, i++) {
+      // keys are stored up to their unique prefix
+      std::string key = iter.getKey();
+      ASSERT_EQ(0, keys[i].compare(0, key.size(), key));
+      ASSERT_EQ(values_uint64[i], iter.getValue());
+    }
+    ASSERT_EQ(keys.size(), i);
+    for (auto iter = surf->moveToLast(); iter.isValid(); iter--) ASSERT_EQ(values_uint64[--i], iter.getValue());
+    ASSERT_EQ(0u, i);
+    // a forward step after backward ones
+    auto iter = surf->moveToLast();
+    for (int step = 0; step < 10; step++) iter--;
+    iter++;
+    ASSERT_EQ(values_uint64[keys.size() - 10], iter.getValue());
+    delete surf;
+  }
+}
+TEST_F (SuRFExampleWords, BatchLookupTest) {
+  FST *surf = new FST(keys, values_uint64, kIncludeDense, 16);
+
+  // existing keys followed by keys that are (mostly) not in the trie
+  std::vector<std::string> missing_keys;
+  for (const auto &key : keys) {
+    missing_keys.emplace_back(key.substr(0, key.size() / 2));
+    missing_keys.emplace_back(key + "~");
+  }
+  std::vector<std::string_view> lookup_keys(keys.begin(), keys.end());
+  lookup_keys.insert(lookup_keys.end(), missing_keys.begin(), missing_keys.end());
+
+  std::vector<uint64_t> values(lookup_keys.size());
+  std::vector<word_t> found((lookup_keys.size() + kWordSize - 1) / kWordSize);
+  size_t num_found = surf->lookupKeys(lookup_keys, values, found);
+
+  size_t expected_found = 0;
+  for (size_t i = 0; i < lookup_keys.size(); i++) {
+    uint64_t value = 0;
+    bool exist = surf->lookupKey(lookup_keys[i], value);
+    ASSERT_EQ(exist, FSTBuilder::readBit(found, i));
+    if (exist) {
+      ASSERT_EQ(value, values[i]);
+      expected_found++;
+    }
+    if (i < keys.size()) {
+      ASSERT_TRUE(exist);
+    }
+  }
+  ASSERT_EQ(expected_found, num_found);
+  delete surf;
+}
+TEST_F (SuRFExampleWords, ByteKeyLookupTest) {
+  FST *surf = new FST(keys, values_uint64, kIncludeDense, 16);
+  for (size_t i = 0; i < keys.size(); i++) {
+    // a copy without terminator, so the lookup must honor key_length
+    std::vector<uint8_t> bytes(keys[i].begin(), keys[i].end());
+    uint64_t value = 0;
+    ASSERT_TRUE(surf->lookupKey(bytes.data(), bytes.size(), value));
+    ASSERT_EQ(values_uint64[i], value);
+
+    // prefixes agree with the string_view overload, found or not
+    const size_t prefix_length = bytes.size() / 2;
+    uint64_t string_value = 0;
+    const bool exist = surf->lookupKey(std::string_view(keys[i]).substr(0, prefix_length), string_value);
+    ASSERT_EQ(exist, surf->lookupKey(bytes.data(), prefix_length, value));
+    if (exist) {
+      ASSERT_EQ(string_value, value);
+    }
+  }
+  delete surf;
+}
+TEST_F (SuRFExampleWords, SparseOnlyLookupTest) {
+  // without dense levels the lookup starts at the sparse root and all values
+  // are sparse values
+  FST *dense = new FST(keys, values_uint64, true, 16);
+  FST *sparse = new FST(keys, values_uint64, false, 16);
+  ASSERT_EQ(0u, sparse->getSparseStartLevel());
+  for (size_t i = 0; i < keys.size(); i++) {
+    uint64_t value = 0;
+    ASSERT_TRUE(sparse->lookupKey(keys[i], value));
+    ASSERT_EQ(values_uint64[i], value);
+
+    const std::string missing_keys[] = {keys[i].substr(0, keys[i].size() / 2), keys[i] + "~", "~" + keys[i]};
+    for (const auto &missing_key : missing_keys) {
+      uint64_t dense_value = 0;
+      const bool exist = dense->lookupKey(missing_key, dense_value);
+      ASSERT_EQ(exist, sparse->lookupKey(missing_key, value));
+      if (exist) {
+        ASSERT_EQ(dense_value, value);
+      }
+    }
+  }
+  delete sparse;
+  delete dense;
+}
+
+TEST_F (SuRFExampleWords, NodeIndexTest) {
+  FST *plain = new FST(keys, values_uint64, false, 16);
+  for (level_t node_index_levels : {level_t(2), kNodeIndexAuto}) {
+    FST *surf = new FST(keys, values_uint64, false, 16, node_index_levels);
+    for (size_t i = 0; i < keys.size(); i++) {
+      uint64_t value = 0;
+      ASSERT_TRUE(surf->lookupKey(keys[i], value));
+      ASSERT_EQ(values_uint64[i], value);
+      std::string missing_key = keys[i] + "~";
+      ASSERT_EQ(plain->lookupKey(missing_key, value), surf->lookupKey(missing_key, value));
+    }
+
+    auto plain_iter = plain->moveToFirst();
+    auto iter = surf->moveToFirst();
+    while (plain_iter.isValid()) {
+      ASSERT_TRUE(iter.isValid());
+      ASSERT_EQ(plain_iter.getKey(), iter.getKey());
+      ASSERT_EQ(plain_iter.getValue(), iter.getValue());
+      plain_iter++;
+      iter++;
+    }
+    ASSERT_FALSE(iter.isValid());
+    delete surf;
+  }
+  delete plain;
+}
+TEST_F (SuRFExampleWords, PrefilterTest) {
+  static const uint32_t kBitsPerKey = 10;
+  FST *plain = new FST(keys, values_uint64, kIncludeDense, 16);
+  FST *surf = new FST(keys, values_uint64, kIncludeDense, 16, kNodeIndexLevels, kBitsPerKey);
+  ASSERT_GT(surf->getMemoryUsage(), plain->getMemoryUsage() + keys.size() * kBitsPerKey / 8);
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    uint64_t value = 0;
+    ASSERT_TRUE(surf->lookupKey(keys[i], value));
+    ASSERT_EQ(values_uint64[i], value);
+  }
+
+  // absent keys: the prefilter may only turn a trie hit into a miss
+  BlockedBloomFilter filter(keys, kBitsPerKey);
+  size_t false_positives = 0;
+  for (size_t i = 0; i < keys.size(); i++) {
+    std::string missing_key = keys[i] + "~";
+    uint64_t value = 0, plain_value = 0;
+    bool found = surf->lookupKey(missing_key, value);
+    if (found) {
+      ASSERT_TRUE(plain->lookupKey(missing_key, plain_value));
+      ASSERT_EQ(plain_value, value);
+    }
+    if (filter.mayContain(missing_key)) false_positives++;
+  }
+  // about 1% expected for 10 bits per key
+  ASSERT_LT(false_positives, keys.size() / 20);
+  delete surf;
+  delete plain;
+}
+TEST_F (SuRFExampleWords, PackedValuesTest) {
+  // 34-bit values straddle word boundaries; full 64-bit values use no mask
+  for (uint64_t multiplier : {uint64_t(1) << 20, uint64_t(0x8000000000000001)}) {
+    std::vector<uint64_t> values(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) values[i] = (i + 1) * multiplier + i;
+    FST *surf = new FST(keys, values, kIncludeDense, 16);
+    for (size_t i = 0; i < keys.size(); i++) {
+      uint64_t value = 0;
+      ASSERT_TRUE(surf->lookupKey(keys[i], value));
+      ASSERT_EQ(values[i], value);
+    }
+    size_t i = 0;
+    for (auto iter = surf->moveToFirst(); iter.isValid(); iter++, i++) ASSERT_EQ(values[i], iter.getValue());
+    ASSERT_EQ(keys.size(), i);
+    delete surf;
+  }
+}
+TEST_F (SuRFExampleWords, ImplicitValuesTest) {
+  // values are the key ordinals, with and without dense leaves
+  for (bool include_dense : {false, true}) {
+    for (uint32_t sparse_dense_ratio : {uint32_t(1), uint32_t(16)}) {
+      FST *surf = new FST();
+      surf->create(keys, include_dense, sparse_dense_ratio);
+      for (size_t i = 0; i < keys.size(); i++) {
+        uint64_t value = 0;
+        ASSERT_TRUE(surf->lookupKey(keys[i], value));
+        ASSERT_EQ(i, value);
+      }
+      size_t i = 0;
+      for (auto iter = surf->moveToFirst(); iter.isValid(); iter++, i++) ASSERT_EQ(i, iter.getValue());
+      ASSERT_EQ(keys.size(), i);
+      for (auto iter = surf->moveToLast(); iter.isValid(); iter--) ASSERT_EQ(--i, iter.getValue());
+      ASSERT_EQ(0u, i);
+      for (size_t j = 0; j < keys.size(); j += 7) {
+        auto iter = surf->moveToKeyGreaterThan(keys[j], true);
+        ASSERT_TRUE(iter.isValid());
+        ASSERT_EQ(j, iter.getValue());
+      }
+
+      std::vector<std::string_view> lookup_keys(keys.begin(), keys.end());
+      std::vector<uint64_t> values(lookup_keys.size());
+      std::vector<word_t> found((lookup_keys.size() + kWordSize - 1) / kWordSize);
+      ASSERT_EQ(keys.size(), surf->lookupKeys(lookup_keys, values, found));
+      for (size_t j = 0; j < keys.size(); j++) ASSERT_EQ(j, values[j]);
+
+      // the subtree leaf counts are serialized with the trie
+      char *data = surf->serialize();
+      FST *deserialized = FST::deSerialize(data);
+      for (size_t j = 0; j < keys.size(); j += 3) {
+        uint64_t value = 0;
+        ASSERT_TRUE(deserialized->lookupKey(keys[j], value));
+        ASSERT_EQ(j, value);
+      }
+      delete deserialized;
+      delete[] data;
+
+      // the node-level lookups have no leaves left of the path to start from
+      if (!include_dense) {
+        uint64_t value = 0;
+        ASSERT_THROW(surf->lookupKeyAtNode(keys[0].data(), keys[0].size(), 0, 0, value), std::logic_error);
+        size_t node_number = 0;
+        ASSERT_THROW(surf->amacLookup(keys[0][0], 0, node_number), std::logic_error);
+      }
+      delete surf;
+    }
+  }
+
+  // "bbbb" is a prefix of "bbbbbba" and cannot be a leaf of its own
+  std::vector<std::string> prefix_keys = {"bbbaba", "bbbabba", "bbbb", "bbbbbba"};
+  FST *surf = new FST(keys);
+  ASSERT_THROW(surf->create(prefix_keys, true, 16), std::invalid_argument);
+  ASSERT_THROW(surf->create(prefix_keys, false, 16), std::invalid_argument);
+  // the previous trie is left as it was
+  uint64_t value = 0;
+  ASSERT_TRUE(surf->lookupKey(keys[5], value));
+  ASSERT_EQ(5u, value);
+  delete surf;
+}
+TEST_F (SuRFExampleWords, KeyFetcherTest) {
+  // length-prefixed keys in one buffer, values index into offsets
+  std::vector<uint8_t> data;
+  std::vector<uint32_t> offsets;
+  for (const auto &key : keys) {
+    offsets.push_back(data.size());
+    data.push_back(key.size());
+    data.insert(data.end(), key.begin(), key.end());
+  }
+  FST *surf = new FST(offsets, values_uint64, data.data());
+
+  char *serialized = surf->serialize();
+  FST *loaded = FST::deSerialize(serialized);
+  loaded->setKeyFetcher(keyVectorFetcher(&keys));
+
+  for (FST *fst : {surf, loaded}) {
+    for (size_t j = 0; j + 1 < keys.size(); j += 7) {
+      auto iter = fst->moveToKeyGreaterThan(keys[j], false);
+      ASSERT_TRUE(iter.isValid());
+      ASSERT_EQ(j + 1, iter.getValue());
+      iter = fst->moveToKeyGreaterThan(keys[j] + "~", true);
+      ASSERT_TRUE(iter.isValid());
+      ASSERT_EQ(j + 1, iter.getValue());
+    }
+  }
+  delete loaded;
+  delete[] serialized;
+  delete surf;
+}
+TEST_F (SuRFExampleWords, CompactTest) {
+  std::pmr::unsynchronized_pool_resource pool;
+  for (int backing = 0; backing < 3; backing++) {
+    FST *surf = new FST(keys, values_uint64, kIncludeDense, 16, kNodeIndexLevels, 10);
+    uint64_t size = surf->serializedSize();
+    if (backing == 0)
+      surf->compact(Arena::Backing::kHugePages);
+    else if (backing == 1)
+      surf->compact(Arena::Backing::kHugeTlb);
+    else
+      surf->compact(&pool);
+    ASSERT_EQ(size, surf->serializedSize());
+
+    for (size_t i = 0; i < keys.size(); i++) {
+      uint64_t value = 0;
+      ASSERT_TRUE(surf->lookupKey(keys[i], value));
+      ASSERT_EQ(values_uint64[i], value);
+    }
+    size_t i = 0;
+    for (auto iter = surf->moveToFirst(); iter.isValid(); iter++, i++) ASSERT_EQ(values_uint64[i], iter.getValue());
+    ASSERT_EQ(keys.size(), i);
+    // the key fetcher survives compaction
+    for (size_t j = 0; j + 1 < keys.size(); j += 7) {
+      auto iter = surf->moveToKeyGreaterThan(keys[j], false);
+      ASSERT_TRUE(iter.isValid());
+      ASSERT_EQ(j + 1, iter.getValue());
+    }
+    // compacting again replaces the arena
+    surf->compact(&pool);
+    uint64_t value = 0;
+    ASSERT_TRUE(surf->lookupKey(keys.back(), value));
+    ASSERT_EQ(values_uint64.back(), value);
+    delete surf;
+  }
+}
+TEST_F (SuRFExampleWords, BuildPeakMemoryTest) {
+  FST *surf = new FST(keys, values_uint64, kIncludeDense, 16);
+  // the builder holds every value at once, packed to the widest one
+  uint64_t max_value = *std::max_element(values_uint64.begin(), values_uint64.end());
+  ASSERT_GE(surf->getBuildPeakMemoryUsage(), keys.size() * PackedValueVector::bitWidth(max_value) / 8);
+  ASSERT_LT(surf->getBuildPeakMemoryUsage(), keys.size() * sizeof(uint64_t) * 4);
+  for (size_t i = 0; i < keys.size(); i++) {
+    uint64_t value = 0;
+    ASSERT_TRUE(surf->lookupKey(keys[i], value));
+    ASSERT_EQ(values_uint64[i], value);
+  }
+  delete surf;
+}
+TEST_F (SuRFExampleWords, StatsTest) {
+  for (bool include_dense : {true, false}) {
+    FST *surf = new FST(keys, values_uint64, include_dense, 16, kNodeIndexLevels, 10);
+    FSTStats stats = surf->getStats();
+    ASSERT_EQ(surf->getHeight(), stats.height);
+    ASSERT_EQ(surf->getSparseStartLevel(), stats.sparse_start_level);
+    ASSERT_EQ(stats.height, stats.levels.size());
+    ASSERT_EQ(surf->getMemoryUsage(), stats.total_bytes);
+    ASSERT_EQ(stats.total_bytes, stats.componentBytes() + stats.other_bytes);
+    ASSERT_GT(stats.labels_bytes, 0u);
+    ASSERT_GT(stats.louds_bits_bytes, 0u);
+    ASSERT_GT(stats.select_lut_bytes, 0u);
+    ASSERT_GT(stats.prefilter_bytes, 0u);
+    ASSERT_EQ(include_dense, stats.dense_bitmap_bytes > 0);
+
+    uint64_t nodes = 0;
+    uint64_t items = 0;
+    uint64_t leaves = 0;
+    uint64_t dense_bitmap_bytes = 0;
+    for (level_t level = 0; level < stats.height; level++) {
+      const FSTLevelStats &level_stats = stats.levels[level];
+      ASSERT_GT(level_stats.nodes, 0u);
+      ASSERT_EQ(level < stats.sparse_start_level, level_stats.dense_bitmap_bytes > 0);
+      // every child of a level is a node of the next one
+      if (level + 1 < stats.height) {
+        ASSERT_EQ(level_stats.items - level_stats.leaves, stats.levels[level + 1].nodes);
+      }
+      nodes += level_stats.nodes;
+      items += level_stats.items;
+      leaves += level_stats.leaves;
+      dense_bitmap_bytes += level_stats.dense_bitmap_bytes;
+    }
+    ASSERT_EQ(keys.size(), leaves);
+    ASSERT_LE(dense_bitmap_bytes, stats.dense_bitmap_bytes);
+
+    uint64_t histogram_nodes = 0;
+    uint64_t histogram_items = 0;
+    for (size_t fanout = 0; fanout < stats.fanout_histogram.size(); fanout++) {
+      histogram_nodes += stats.fanout_histogram[fanout];
+      histogram_items += fanout * stats.fanout_histogram[fanout];
+    }
+    ASSERT_EQ(nodes, histogram_nodes);
+    ASSERT_EQ(items, histogram_items);
+
+    // the level shapes are serialized
+    surf->compact();
+    FSTStats compacted = surf->getStats();
+    for (level_t level = 0; level < stats.height; level++) {
+      ASSERT_EQ(stats.levels[level].nodes, compacted.levels[level].nodes);
+      ASSERT_EQ(stats.levels[level].items, compacted.levels[level].items);
+      ASSERT_EQ(stats.levels[level].leaves, compacted.levels[level].leaves);
+    }
+    ASSERT_EQ(stats.fanout_histogram, compacted.fanout_histogram);
+    delete surf;
+  }
+}
+TEST_F (SuRFExampleWords, WorkloadCutoffTest) {
+  StepCosts costs = FST::calibrateStepCosts();
+  ASSERT_GT(costs.dense_ns, 0);
+  ASSERT_GT(costs.sparse_ns, 0);
+
+  CutoffWorkload workload;
+  workload.step_costs = StepCosts{1, 4};
+  workload.queries.assign(keys.begin(), keys.end());
+  FST *surf = new FST();
+  surf->create(keys, values_uint64, workload);
+  // dense steps are cheaper and memory is unbounded: every level any
+  // lookup walks through is dense
+  level_t unbounded_level = surf->getSparseStartLevel();
+  ASSERT_GT(unbounded_level, 0u);
+  for (size_t i = 0; i < keys.size(); i++) {
+    uint64_t value = 0;
+    ASSERT_TRUE(surf->lookupKey(keys[i], value));
+    ASSERT_EQ(values_uint64[i], value);
+  }
+  delete surf;
+
+  // a budget below the smallest trie builds the smallest one
+  workload.memory_budget = 0;
+  surf = new FST();
+  surf->create(keys, values_uint64, workload);
+  ASSERT_LT(surf->getSparseStartLevel(), unbounded_level);
+  delete surf;
+
+  // lookups that all end at the root gain nothing from dense levels below it
+  workload.memory_budget = std::numeric_limits<uint64_t>::max();
+  workload.queries.assign(100, std::string(1, '\x01'));
+  surf = new FST();
+  surf->create(keys, values_uint64, workload);
+  ASSERT_EQ(1u, surf->getSparseStartLevel());
+  delete surf;
+
+  // an access profile of the stored keys works the same as queries
+  workload.queries.clear();
+  workload.key_frequencies.assign(keys.size(), 1);
+  surf = new FST();
+  surf->create(keys, values_uint64, workload);
+  ASSERT_EQ(unbounded_level, surf->getSparseStartLevel());
+  delete surf;
+}
+TEST_F (SuRFExampleWords, ParallelBuildTest) {
+  // all words start with the same byte, spread them over several root
+  // subtrees of different sizes
+  std::vector<std::string> spread_keys;
+  for (size_t i = 0; i < keys.size(); i++) spread_keys.push_back(std::string(1, 'a' + i * i % 23) + keys[i]);
+  std::sort(spread_keys.begin(), spread_keys.end());
+  for (const std::vector<std::string> *key_set : {&keys, &spread_keys}) {
+    for (bool include_dense : {true, false}) {
+      FST *sequential = new FST(*key_set, values_uint64, include_dense, 16, kNodeIndexLevels, 10);
+      std::vector<char> expected = serializeAligned(*sequential);
+      for (unsigned num_threads : {1u, 2u, 3u, 8u, 64u, 1000u}) {
+        FST *parallel = new FST();
+        parallel->createParallel(*key_set, values_uint64, num_threads, include_dense, 16, kNodeIndexLevels, 10);
+        ASSERT_EQ(expected, serializeAligned(*parallel));
+        delete parallel;
+      }
+      delete sequential;
+    }
+  }
+}
+TEST_F (SuRFExampleWords, StreamingBuildTest) {
+  for (bool include_dense : {true, false}) {
+    FST *expected = new FST(keys, values_uint64, include_dense, 16, kNodeIndexLevels, 0);
+    FSTBuilder builder(include_dense, 16);
+    for (size_t i = 0; i < keys.size(); i++) {
+      builder.add(keys[i], values_uint64[i]);
+      // repeated keys keep their first value
+      if (i % 5 == 0) builder.add(keys[i], 0);
+    }
+    builder.finish();
+    FST *surf = new FST();
+    surf->create(builder);
+    ASSERT_EQ(serializeAligned(*expected), serializeAligned(*surf));
+
+    surf->setKeyFetcher(keyVectorFetcher(&keys));
+    for (size_t i = 0; i + 1 < keys.size(); i += 7) {
+      auto iter = surf->moveToKeyGreaterThan(keys[i], false);
+      ASSERT_TRUE(iter.isValid());
+      ASSERT_EQ(i + 1, iter.getValue());
+    }
+    delete surf;
+    delete expected;
+  }
+}
+TEST_F (SuRFExampleWords, UnsortedBuildTest) {
+  // shuffled, with every tenth key repeated at the end; values index
+  // unsorted_keys
+  std::vector<std::string> unsorted_keys(keys);
+  std::shuffle(unsorted_keys.begin(), unsorted_keys.end(), std::mt19937(42));
+  for (size_t i = 0; i < keys.size(); i += 10) unsorted_keys.push_back(unsorted_keys[i]);
+  std::vector<uint64_t> values(unsorted_keys.size());
+  std::map<std::string, uint64_t> first_values;
+  std::map<std::string, uint64_t> last_values;
+  for (size_t i = 0; i < unsorted_keys.size(); i++) {
+    values[i] = i;
+    first_values.emplace(unsorted_keys[i], i);
+    last_values[unsorted_keys[i]] = i;
+  }
+
+  for (unsigned num_threads : {1u, 4u}) {
+    for (auto duplicates : {FST::DuplicatePolicy::kKeepFirst, FST::DuplicatePolicy::kKeepLast}) {
+      const auto &kept_values = duplicates == FST::DuplicatePolicy::kKeepFirst ? first_values : last_values;
+      std::vector<uint64_t> sorted_values;
+      for (const auto &key : keys) sorted_values.push_back(kept_values.at(key));
+      // the prefilter holds each repeated key once
+      FST *expected = new FST(keys, sorted_values, kIncludeDense, 16, kNodeIndexLevels, 10);
+      FST *surf = new FST();
+      surf->createUnsorted(unsorted_keys, values, duplicates, num_threads, kIncludeDense, 16, kNodeIndexLevels, 10);
+      ASSERT_EQ(serializeAligned(*expected), serializeAligned(*surf));
+      for (size_t i = 0; i + 1 < keys.size(); i += 7) {
+        auto iter = surf->moveToKeyGreaterThan(keys[i], false);
+        ASSERT_TRUE(iter.isValid());
+        ASSERT_EQ(keys[i + 1], unsorted_keys[iter.getValue()]);
+      }
+      delete surf;
+      delete expected;
+    }
+
+    FST *surf = new FST();
+    surf->createUnsorted(keys, values_uint64, FST::DuplicatePolicy::kError, num_threads);
+    const std::vector<char> before = serializeAligned(*surf);
+    // a rejected call leaves the FST as it was
+    ASSERT_THROW(surf->createUnsorted(unsorted_keys, values, FST::DuplicatePolicy::kError, num_threads),
+                 std::invalid_argument);
+    ASSERT_EQ(before, serializeAligned(*surf));
+    for (size_t i = 0; i < keys.size(); i += 7) {
+      uint64_t value = 0;
+      ASSERT_TRUE(surf->lookupKey(keys[i], value));
+      ASSERT_EQ(values_uint64[i], value);
+    }
+    size_t i = 0;
+    for (auto iter = surf->moveToFirst(); iter.isValid(); iter++, i++) ASSERT_EQ(values_uint64[i], iter.getValue());
+    ASSERT_EQ(keys.size(), i);
+    delete surf;
+  }
+
+  // the radix sort orders prefixes first and bytes as unsigned
+  std::vector<std::string> tricky = {"b", "", "ab", "a", "\xff", "a\x80", "a\x01", "ab", "a"};
+  std::vector<uint64_t> order = RadixSorter(tricky, 3).sort();
+  std::vector<uint64_t> expected_order(tricky.size());
+  for (size_t i = 0; i < expected_order.size(); i++) expected_order[i] = i;
+  std::stable_sort(expected_order.begin(), expected_order.end(),
+                   [&](uint64_t a, uint64_t b) { return tricky[a] < tricky[b]; });
+  ASSERT_EQ(expected_order, order);
+}
+TEST_F (SuRFExampleWords, MergeTest) {
+  // base holds the even keys; the delta inserts, updates and erases keys and
+  // erases some absent ones
+  std::vector<std::string> base_keys;
+  std::vector<uint64_t> base_values;
+  std::vector<FST::DeltaEntry> delta;
+  std::vector<std::string> merged_keys;
+  std::vector<uint64_t> merged_values;
+  for (size_t i = 0; i < keys.size(); i++) {
+    const bool in_base = i % 2 == 0;
+    if (in_base) {
+      base_values.push_back(base_keys.size());
+      base_keys.push_back(keys[i]);
+    }
+    if (in_base && i % 5 == 0) {
+      delta.push_back({keys[i], 0, true});
+    } else if (i % 7 == 0 || (!in_base && i % 3 == 0)) {
+      delta.push_back({keys[i], 1000000 + i, false});
+      merged_keys.push_back(keys[i]);
+      merged_values.push_back(1000000 + i);
+    } else if (in_base) {
+      merged_keys.push_back(keys[i]);
+      merged_values.push_back(base_values.back());
+    } else if (i % 11 == 1) {
+      delta.push_back({keys[i], 0, true});
+    }
+  }
+
+  FST *base = new FST(base_keys, base_values, kIncludeDense, 16, kNodeIndexLevels, 0);
+  FST *expected = new FST(merged_keys, merged_values, kIncludeDense, 16, kNodeIndexLevels, 0);
+  FST *surf = new FST();
+  surf->merge(*base, delta, kIncludeDense, 16);
+  ASSERT_EQ(serializeAligned(*expected), serializeAligned(*surf));
+
+  surf->setKeyFetcher([&](const uint64_t value) -> std::string_view {
+    return value >= 1000000 ? keys[value - 1000000] : base_keys[value];
+  });
+  for (size_t i = 0; i < merged_keys.size(); i++) {
+    uint64_t value = 0;
+    ASSERT_TRUE(surf->lookupKey(merged_keys[i], value));
+    ASSERT_EQ(merged_values[i], value);
+    if (i + 1 < merged_keys.size()) {
+      auto iter = surf->moveToKeyGreaterThan(merged_keys[i], false);
+      ASSERT_TRUE(iter.isValid());
+      ASSERT_EQ(merged_values[i + 1], iter.getValue());
+    }
+  }
+
+  // merging into base itself, with an empty delta
+  base->merge(*base, {}, kIncludeDense, 16);
+  FST *base_copy = new FST(base_keys, base_values, kIncludeDense, 16, kNodeIndexLevels, 0);
+  ASSERT_EQ(serializeAligned(*base_copy), serializeAligned(*base));
+  ASSERT_THROW(surf->merge(*base, delta), std::invalid_argument);
+  base->setKeyFetcher(keyVectorFetcher(&base_keys));
+
+  std::vector<FST::DeltaEntry> unsorted = {{keys[3], 1, false}, {keys[1], 2, false}};
+  ASSERT_THROW(surf->merge(*base, unsorted), std::invalid_argument);
+  std::vector<FST::DeltaEntry> erase_all;
+  for (const auto &key : base_keys) erase_all.push_back({key, 0, true});
+  ASSERT_THROW(surf->merge(*base, erase_all), std::invalid_argument);
+  // a failed merge leaves the FST as it was
+  ASSERT_EQ(serializeAligned(*expected), serializeAligned(*surf));
+
+  delete base_copy;
+  delete surf;
+  delete expected;
+  delete base;
+}
 } // namespace surftest
 
 } // namespace fst
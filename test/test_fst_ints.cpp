@@ -1,9 +1,12 @@
 #include "gtest/gtest.h"
+#include <algorithm>
 #include <random>
 #include <string>
 #include <vector>
 #include "config.hpp"
 #include "fst.hpp"
+#include "fixed_key_fst.hpp"
+#include "test_util.hpp"
 #include <chrono>
 
 namespace fst::surftest {
@@ -97,6 +100,100 @@ TEST_F (SuRFInt32Test, PointLookupTests) {
   std::cout << "query time " << std::to_string(elapsed.count()) << std::endl;
 }
 
+// keys are only stored up to their unique prefix, so absent keys must
+// resolve as in the generic lookup
+template <typename Int>
+void checkFixedKeyLookups(const std::vector<Int> &keys, const std::vector<uint64_t> &values,
+                          const bool include_dense) {
+  FixedKeyFST<Int> fst(keys, values, include_dense, 128, kNodeIndexLevels, 10);
+  std::vector<std::string> string_keys;
+  for (auto key : keys) string_keys.push_back(FixedKeyFST<Int>::keyToString(key));
+  FST generic(string_keys, values, include_dense, 128, kNodeIndexLevels, 10);
+  for (size_t i = 0; i < keys.size(); i++) {
+    uint64_t value = 0;
+    ASSERT_TRUE(fst.lookupKey(keys[i], value));
+    ASSERT_EQ(values[i], value);
+    uint64_t generic_value = 0;
+    bool generic_found = generic.lookupKey(FixedKeyFST<Int>::keyToString(keys[i] + 1), generic_value);
+    ASSERT_EQ(generic_found, fst.lookupKey(keys[i] + 1, value));
+    if (generic_found) {
+      ASSERT_EQ(generic_value, value);
+    }
+  }
+}
+
+TEST_F (SuRFInt32Test, FixedKeyLookupTests) {
+  std::vector<uint32_t> keys(number_keys);
+  std::vector<uint64_t> keys_uint64(number_keys);
+  for (uint32_t i = 0; i < number_keys; i++) {
+    keys[i] = 3 + i * kIntTestSkip;
+    // spread over all eight key bytes
+    keys_uint64[i] = (uint64_t(i) << 40) + uint64_t(i) * 0x9E3779B9;
+  }
+  for (bool include_dense : {true, false}) {
+    checkFixedKeyLookups(keys, values_uint64, include_dense);
+    checkFixedKeyLookups(keys_uint64, values_uint64, include_dense);
+  }
+}
+
+TEST_F (SuRFInt32Test, FixedKeyIteratorTests) {
+  std::vector<uint32_t> keys(number_keys);
+  std::vector<uint64_t> values(number_keys);
+  for (uint32_t i = 0; i < number_keys; i++) {
+    keys[i] = 3 + i * kIntTestSkip;
+    values[i] = i;
+  }
+  FixedKeyFST<uint32_t> fst(keys, values);
+  for (size_t i = 0; i + 1 < number_keys; i += 997) {
+    FST::Iter iter = fst.moveToKeyGreaterThan(keys[i], false);
+    ASSERT_TRUE(iter.isValid());
+    ASSERT_EQ(i + 1, iter.getValue());
+    iter = fst.moveToKeyGreaterThan(keys[i] + 1, true);
+    ASSERT_TRUE(iter.isValid());
+    ASSERT_EQ(i + 1, iter.getValue());
+  }
+}
+
+// the integer build must store the same trie as the big-endian strings
+template <typename Int>
+void checkIntegerBuild(const std::vector<Int> &keys, const std::vector<uint64_t> &values, const bool include_dense) {
+  auto start = std::chrono::high_resolution_clock::now();
+  std::vector<std::string> string_keys;
+  string_keys.reserve(keys.size());
+  for (auto key : keys) string_keys.push_back(FixedKeyFST<Int>::keyToString(key));
+  FST expected(string_keys, values, include_dense, 16, kNodeIndexLevels, 10);
+  std::chrono::duration<double> string_build = std::chrono::high_resolution_clock::now() - start;
+
+  start = std::chrono::high_resolution_clock::now();
+  FST fst;
+  fst.create(keys, values, include_dense, 16, kNodeIndexLevels, 10);
+  std::chrono::duration<double> integer_build = std::chrono::high_resolution_clock::now() - start;
+  std::cout << sizeof(Int) * 8 << "-bit keys build time: strings " << string_build.count() << " s, integers "
+            << integer_build.count() << " s" << std::endl;
+  ASSERT_EQ(serializeAligned(expected), serializeAligned(fst));
+}
+
+TEST_F (SuRFInt32Test, IntegerBuildTests) {
+  std::mt19937_64 random(42);
+  std::vector<uint32_t> keys(number_keys);
+  std::vector<uint64_t> keys_uint64(number_keys);
+  for (uint32_t i = 0; i < number_keys; i++) {
+    keys[i] = random();
+    keys_uint64[i] = random() >> (i % 64);
+  }
+  // repeated keys keep their first value
+  for (uint32_t i = 0; i < number_keys; i += 101) {
+    keys[i + 1] = keys[i];
+    keys_uint64[i + 1] = keys_uint64[i];
+  }
+  std::sort(keys.begin(), keys.end());
+  std::sort(keys_uint64.begin(), keys_uint64.end());
+  for (bool include_dense : {true, false}) {
+    checkIntegerBuild(keys, values_uint64, include_dense);
+    checkIntegerBuild(keys_uint64, values_uint64, include_dense);
+  }
+}
+
 // todo adapt iterator logic
 TEST_F (SuRFInt32Test, IteratorTestsGreaterThanExclusive) {
   auto fst =
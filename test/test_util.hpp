@@ -0,0 +1,25 @@
+#ifndef TESTUTIL_H_
+#define TESTUTIL_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "config.hpp"
+#include "fst.hpp"
+
+namespace fst::surftest {
+
+// Serialized bytes of fst, for comparing tries. The cache-line padding
+// depends on the alignment of the buffer, so it is written cache-line
+// aligned.
+inline std::vector<char> serializeAligned(const FST &fst) {
+  std::vector<char> buffer(fst.serializedSize() + kCacheLineSize, 0);
+  char *begin = buffer.data() + (kCacheLineSize - (uint64_t) buffer.data() % kCacheLineSize) % kCacheLineSize;
+  char *dst = begin;
+  fst.serialize(dst);
+  return std::vector<char>(begin, dst);
+}
+
+}  // namespace fst::surftest
+
+#endif  // TESTUTIL_H_